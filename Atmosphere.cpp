@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include "Atmosphere.h"
+
+using namespace std;
+
+// Earth, per km. Rayleigh and Mie from Bruneton's 2017 reference implementation
+static const float earthAtmosphereHeight = 60;
+static const glm::vec3 earthRayleighScattering = glm::vec3(5.802e-3, 13.558e-3, 33.1e-3);
+static const float earthRayleighScaleHeight = 8;
+static const float earthMieScattering = 3.996e-3;
+static const float earthMieExtinction = 4.44e-3;
+static const float earthMieScaleHeight = 1.2;
+static const float mieG = 0.8;
+// Lowest sun elevation cosine the scattering table covers
+static const float muSMin = -0.2;
+
+// Resolutions at lutScale 1
+static const int baseTransmittanceWidth = 256;
+static const int baseTransmittanceHeight = 64;
+static const int baseScatteringMuS = 32;
+static const int baseScatteringMu = 128;
+static const int baseScatteringR = 32;
+
+static const int transmittanceSamples = 128;
+static const int scatteringSamples = 64;
+
+static const char cacheMagic[8] = "ATMOLUT";
+static const int cacheVersion = 2;
+
+struct Atmosphere::CacheHeader {
+    char magic[8];
+    int version;
+    float planetRadius;
+    float atmosphereHeight;
+    float lutScale;
+    int sizes[5];
+    int samples[2];
+    float rayleighScattering[3];
+    float mieScattering;
+    float mieExtinction;
+    float rayleighScaleHeight;
+    float mieScaleHeight;
+    float muSMin;
+};
+
+static float clampCosine(float mu)
+{
+    return max(-1.0f, min(1.0f, mu));
+}
+
+// Inverse of coordFromUnit in atmosphere.glsl: texel i of n maps to i/(n-1)
+static float unitFromTexel(int i, int n)
+{
+    return (float) i/(n - 1);
+}
+
+static int scaledSize(int base, float scale, int minimum)
+{
+    return max(minimum, (int) (base*scale + 0.5f));
+}
+
+// Runs work(begin, end) over [0, count) split across the available cores
+static void parallelFor(int count, const function<void(int, int)> &work)
+{
+    int threads = thread::hardware_concurrency();
+    threads = min(max(threads, 1), count);
+
+    int chunk = (count + threads - 1)/threads;
+    vector<thread> workers;
+    for (int begin = chunk; begin < count; begin += chunk)
+        workers.push_back(thread(work, begin, min(begin + chunk, count)));
+    work(0, min(chunk, count));
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void Atmosphere::computeParameters()
+{
+    transmittanceWidth = scaledSize(baseTransmittanceWidth, lutScale, 4);
+    transmittanceHeight = scaledSize(baseTransmittanceHeight, lutScale, 4);
+    scatteringMuS = scaledSize(baseScatteringMuS, lutScale, 4);
+    // The mu axis holds two halves, rays that hit the ground and rays that do not
+    scatteringMu = scaledSize(baseScatteringMu/2, lutScale, 2)*2;
+    scatteringR = scaledSize(baseScatteringR, lutScale, 4);
+
+    float unitsPerKm = atmosphereHeight/earthAtmosphereHeight;
+    rayleighScattering = earthRayleighScattering/unitsPerKm;
+    mieScattering = glm::vec3(earthMieScattering/unitsPerKm);
+    mieExtinction = glm::vec3(earthMieExtinction/unitsPerKm);
+    rayleighScaleHeight = earthRayleighScaleHeight*unitsPerKm;
+    mieScaleHeight = earthMieScaleHeight*unitsPerKm;
+}
+
+void Atmosphere::init()
+{
+    computeParameters();
+
+    if (loadCache()) {
+        printf("Atmosphere tables loaded from %s\n", cachePath.c_str());
+        return;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    precompute();
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("Atmosphere tables computed in %.0f ms\n", elapsed);
+
+    saveCache();
+}
+
+void Atmosphere::precompute()
+{
+    transmittance.assign(transmittanceWidth*transmittanceHeight*3, 0);
+    scattering.assign(scatteringMuS*scatteringMu*scatteringR*4, 0);
+
+    // Scattering samples the transmittance table, so it goes first
+    parallelFor(transmittanceHeight, [this](int begin, int end) { precomputeTransmittance(begin, end); });
+    parallelFor(scatteringR, [this](int begin, int end) { precomputeScattering(begin, end); });
+}
+
+void Atmosphere::precomputeTransmittance(int rowBegin, int rowEnd)
+{
+    float bottom = planetRadius;
+    float top = topRadius();
+    float H = sqrt(top*top - bottom*bottom);
+
+    for (int j = rowBegin; j < rowEnd; j++) {
+        // Rows are spaced by the distance to the horizon, which packs them
+        // near the ground where the density changes fastest
+        float rho = H*unitFromTexel(j, transmittanceHeight);
+        float r = sqrt(rho*rho + bottom*bottom);
+
+        for (int i = 0; i < transmittanceWidth; i++) {
+            // Columns are spaced by the distance to the top of the atmosphere
+            float dMin = top - r;
+            float dMax = rho + H;
+            float d = dMin + unitFromTexel(i, transmittanceWidth)*(dMax - dMin);
+            float mu = d == 0 ? 1 : clampCosine((H*H - rho*rho - d*d)/(2*r*d));
+
+            // Trapezoidal optical depth to the top
+            float dx = d/transmittanceSamples;
+            float rayleighDepth = 0, mieDepth = 0;
+            for (int s = 0; s <= transmittanceSamples; s++) {
+                float t = s*dx;
+                float height = sqrt(t*t + 2*r*mu*t + r*r) - bottom;
+                float weight = s == 0 || s == transmittanceSamples ? 0.5f : 1;
+                rayleighDepth += weight*exp(-height/rayleighScaleHeight);
+                mieDepth += weight*exp(-height/mieScaleHeight);
+            }
+
+            glm::vec3 depth = (rayleighScattering*rayleighDepth + mieExtinction*mieDepth)*dx;
+            float *texel = &transmittance[(j*transmittanceWidth + i)*3];
+            texel[0] = exp(-depth.x);
+            texel[1] = exp(-depth.y);
+            texel[2] = exp(-depth.z);
+        }
+    }
+}
+
+void Atmosphere::precomputeScattering(int sliceBegin, int sliceEnd)
+{
+    float bottom = planetRadius;
+    float top = topRadius();
+    float H = sqrt(top*top - bottom*bottom);
+    int halfMu = scatteringMu/2;
+
+    for (int k = sliceBegin; k < sliceEnd; k++) {
+        float rho = H*unitFromTexel(k, scatteringR);
+        float r = sqrt(rho*rho + bottom*bottom);
+
+        for (int j = 0; j < scatteringMu; j++) {
+            // Same mapping as the transmittance table, done separately for
+            // each half so the horizon falls on a texel boundary
+            bool ground = j < halfMu;
+            float mu, distance;
+            if (ground) {
+                float x = unitFromTexel(halfMu - 1 - j, halfMu);
+                float dMin = r - bottom;
+                float dMax = rho;
+                distance = dMin + x*(dMax - dMin);
+                mu = distance == 0 ? -1 : clampCosine(-(rho*rho + distance*distance)/(2*r*distance));
+            } else {
+                float x = unitFromTexel(j - halfMu, halfMu);
+                float dMin = top - r;
+                float dMax = rho + H;
+                distance = dMin + x*(dMax - dMin);
+                mu = distance == 0 ? 1 : clampCosine((H*H - rho*rho - distance*distance)/(2*r*distance));
+            }
+
+            for (int i = 0; i < scatteringMuS; i++) {
+                float muS = muSMin + unitFromTexel(i, scatteringMuS)*(1 - muSMin);
+                // The table has no view-sun azimuth axis; the cosine of the
+                // angle between them is taken at its azimuthal average
+                float nu = mu*muS;
+
+                float dx = distance/scatteringSamples;
+                glm::vec3 rayleigh(0), opticalDepth(0), previousExtinction(0);
+                float mie = 0;
+                for (int s = 0; s <= scatteringSamples; s++) {
+                    float t = s*dx;
+                    float ri = min(top, max(bottom, (float) sqrt(t*t + 2*r*mu*t + r*r)));
+                    float muSi = clampCosine((r*muS + t*nu)/ri);
+                    float height = ri - bottom;
+                    float rayleighDensity = exp(-height/rayleighScaleHeight);
+                    float mieDensity = exp(-height/mieScaleHeight);
+
+                    glm::vec3 extinction = rayleighScattering*rayleighDensity + mieExtinction*mieDensity;
+                    if (s > 0)
+                        opticalDepth += 0.5f*dx*(previousExtinction + extinction);
+                    previousExtinction = extinction;
+
+                    // Points in the planet's shadow see no sun
+                    float cosHorizon = -sqrt(max(0.0f, 1 - bottom*bottom/(ri*ri)));
+                    if (muSi < cosHorizon)
+                        continue;
+
+                    glm::vec3 viewTransmittance(exp(-opticalDepth.x), exp(-opticalDepth.y), exp(-opticalDepth.z));
+                    glm::vec3 light = viewTransmittance*transmittanceToTop(ri, muSi);
+                    float weight = s == 0 || s == scatteringSamples ? 0.5f : 1;
+                    rayleigh += weight*rayleighDensity*light;
+                    mie += weight*mieDensity*light.x;
+                }
+
+                // Phase functions are applied per fragment
+                rayleigh = rayleigh*rayleighScattering*dx;
+                mie *= mieScattering.x*dx;
+
+                float *texel = &scattering[((k*scatteringMu + j)*scatteringMuS + i)*4];
+                texel[0] = rayleigh.x;
+                texel[1] = rayleigh.y;
+                texel[2] = rayleigh.z;
+                texel[3] = mie;
+            }
+        }
+    }
+}
+
+glm::vec3 Atmosphere::transmittanceToTop(float r, float mu) const
+{
+    float bottom = planetRadius;
+    float top = topRadius();
+    float H = sqrt(top*top - bottom*bottom);
+    float rho = sqrt(max(0.0f, r*r - bottom*bottom));
+
+    float d = max(0.0f, -r*mu + (float) sqrt(max(0.0f, r*r*(mu*mu - 1) + top*top)));
+    float dMin = top - r;
+    float dMax = rho + H;
+    float xMu = dMax > dMin ? (d - dMin)/(dMax - dMin) : 0;
+    float xR = rho/H;
+
+    // Bilinear, matching what the GPU does with the uploaded table
+    float fx = max(0.0f, min(1.0f, xMu))*(transmittanceWidth - 1);
+    float fy = max(0.0f, min(1.0f, xR))*(transmittanceHeight - 1);
+    int x0 = min((int) fx, transmittanceWidth - 2);
+    int y0 = min((int) fy, transmittanceHeight - 2);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    glm::vec3 result(0);
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            const float *texel = &transmittance[((y0 + y)*transmittanceWidth + x0 + x)*3];
+            float weight = (x ? tx : 1 - tx)*(y ? ty : 1 - ty);
+            result += weight*glm::vec3(texel[0], texel[1], texel[2]);
+        }
+    }
+    return result;
+}
+
+void Atmosphere::fillCacheHeader(CacheHeader &header) const
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.planetRadius = planetRadius;
+    header.atmosphereHeight = atmosphereHeight;
+    header.lutScale = lutScale;
+    header.sizes[0] = transmittanceWidth;
+    header.sizes[1] = transmittanceHeight;
+    header.sizes[2] = scatteringMuS;
+    header.sizes[3] = scatteringMu;
+    header.sizes[4] = scatteringR;
+    header.samples[0] = transmittanceSamples;
+    header.samples[1] = scatteringSamples;
+    for (int i = 0; i < 3; i++)
+        header.rayleighScattering[i] = rayleighScattering[i];
+    header.mieScattering = mieScattering.x;
+    header.mieExtinction = mieExtinction.x;
+    header.rayleighScaleHeight = rayleighScaleHeight;
+    header.mieScaleHeight = mieScaleHeight;
+    header.muSMin = muSMin;
+}
+
+bool Atmosphere::loadCache()
+{
+    FILE *file = fopen(cachePath.c_str(), "rb");
+    if (!file)
+        return false;
+
+    CacheHeader expected, header;
+    fillCacheHeader(expected);
+
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(&header, &expected, sizeof(header)) == 0;
+    if (valid) {
+        transmittance.resize(transmittanceWidth*transmittanceHeight*3);
+        scattering.resize(scatteringMuS*scatteringMu*scatteringR*4);
+        valid = fread(transmittance.data(), sizeof(float), transmittance.size(), file) == transmittance.size() &&
+                fread(scattering.data(), sizeof(float), scattering.size(), file) == scattering.size();
+    }
+    fclose(file);
+
+    if (!valid)
+        printf("Atmosphere cache %s is stale, recomputing\n", cachePath.c_str());
+    return valid;
+}
+
+void Atmosphere::saveCache() const
+{
+    FILE *file = fopen(cachePath.c_str(), "wb");
+    if (!file) {
+        printf("Cannot write atmosphere cache %s\n", cachePath.c_str());
+        return;
+    }
+
+    CacheHeader header;
+    fillCacheHeader(header);
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(transmittance.data(), sizeof(float), transmittance.size(), file);
+    fwrite(scattering.data(), sizeof(float), scattering.size(), file);
+    fclose(file);
+}
+
+void Atmosphere::upload(ResourceManager *resources, int transmittanceUnit, int scatteringUnit)
+{
+    // Half floats are plenty for values this smooth and halve the memory
+    transmittanceLUT = resources->createTexture("atmosphere transmittance", false);
+    resources->textureStorage(transmittanceLUT, GL_TEXTURE_2D, GL_RGB16F, transmittanceWidth, transmittanceHeight, 1,
+                              false);
+    resources->bindTextureForEdit(transmittanceUnit, transmittanceLUT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, transmittanceWidth, transmittanceHeight, 0, GL_RGB, GL_FLOAT,
+                 transmittance.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    scatteringLUT = resources->createTexture("atmosphere scattering", false);
+    resources->textureStorage(scatteringLUT, GL_TEXTURE_3D, GL_RGBA16F, scatteringMuS, scatteringMu, scatteringR,
+                              false);
+    resources->bindTextureForEdit(scatteringUnit, scatteringLUT);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, scatteringMuS, scatteringMu, scatteringR, 0, GL_RGBA, GL_FLOAT,
+                 scattering.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // The GPU copies are all that is needed from here on
+    vector<float>().swap(transmittance);
+    vector<float>().swap(scattering);
+}
+
+void Atmosphere::setUniforms(GLState *state, GLuint program, int transmittanceUnit, int scatteringUnit) const
+{
+    state->uniform1i(glGetUniformLocation(program, "TransmittanceLUT"), transmittanceUnit);
+    state->uniform1i(glGetUniformLocation(program, "ScatteringLUT"), scatteringUnit);
+    state->uniform1f(glGetUniformLocation(program, "planetRadius"), planetRadius);
+    state->uniform1f(glGetUniformLocation(program, "atmosphereRadius"), topRadius());
+    state->uniform3fv(glGetUniformLocation(program, "rayleighScattering"), &rayleighScattering.x);
+    state->uniform3fv(glGetUniformLocation(program, "mieScattering"), &mieScattering.x);
+    state->uniform1f(glGetUniformLocation(program, "mieG"), mieG);
+    state->uniform1f(glGetUniformLocation(program, "muSMin"), muSMin);
+    state->uniform1f(glGetUniformLocation(program, "sunIntensity"), sunIntensity);
+}
+
+void Atmosphere::destroy()
+{
+    transmittanceLUT.reset();
+    scatteringLUT.reset();
+}
+
+size_t Atmosphere::memoryUsage() const
+{
+    // GPU bytes, 16 bit channels
+    return (size_t) transmittanceWidth*transmittanceHeight*3*2 +
+           (size_t) scatteringMuS*scatteringMu*scatteringR*4*2;
+}
+
+void Atmosphere::printInfo(ostream &out) const
+{
+    out << "Atmosphere LUTs at scale " << lutScale << ": transmittance " << transmittanceWidth << "x"
+        << transmittanceHeight << ", scattering " << scatteringMuS << "x" << scatteringMu << "x" << scatteringR
+        << ", " << memoryUsage()/1024 << " KB" << endl;
+}
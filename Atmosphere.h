@@ -0,0 +1,91 @@
+#ifndef ATMOSPHERE_H
+#define ATMOSPHERE_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <GL/glew.h>
+#include "../glm/glm/glm.hpp"
+#include "GLState.h"
+#include "ResourceManager.h"
+
+using namespace std;
+
+// Precomputed single scattering for a Rayleigh + Mie atmosphere, after
+// Bruneton and Neyret. Two lookup tables are baked on the CPU, spread over
+// all cores, and cached to disk so later runs only read them back:
+//   transmittance (r, mu)        - RGB, light reaching the top of the atmosphere
+//   scattering    (r, mu, mu_s)  - RGB Rayleigh and red Mie in-scattering
+// The shaders in atmosphere.glsl turn these into sky colour and aerial
+// perspective with a handful of texture fetches. Everything is in scene
+// units; the Earth's coefficients are rescaled so the optical depth of
+// atmosphereHeight matches the real 60 km.
+class Atmosphere {
+public:
+    float planetRadius = 600;
+    float atmosphereHeight = 120;
+    float sunIntensity = 12;
+    // Scales every LUT dimension: 0.5 takes an eighth of the memory of 1
+    float lutScale = 1;
+    string cachePath = "atmosphere.lut"; // EclipseMap keeps it next to the scene file
+
+    // Loads the cache if it matches the settings above, otherwise bakes and saves it
+    void init();
+
+    void upload(ResourceManager *resources, int transmittanceUnit, int scatteringUnit);
+
+    // Sets the atmosphere.glsl uniforms of the program bound in state
+    void setUniforms(GLState *state, GLuint program, int transmittanceUnit, int scatteringUnit) const;
+
+    void destroy();
+
+    size_t memoryUsage() const;
+
+    void printInfo(ostream &out) const;
+
+    float topRadius() const { return planetRadius + atmosphereHeight; }
+
+    const ResourceHandle &transmittanceTexture() const { return transmittanceLUT; }
+
+    const ResourceHandle &scatteringTexture() const { return scatteringLUT; }
+
+private:
+    struct CacheHeader;
+
+    int transmittanceWidth = 0;     // mu
+    int transmittanceHeight = 0;    // r
+    int scatteringMuS = 0;
+    int scatteringMu = 0;
+    int scatteringR = 0;
+
+    vector<float> transmittance;    // RGB
+    vector<float> scattering;       // RGBA
+
+    ResourceHandle transmittanceLUT;
+    ResourceHandle scatteringLUT;
+
+    glm::vec3 rayleighScattering;
+    glm::vec3 mieScattering;
+    glm::vec3 mieExtinction;
+    float rayleighScaleHeight;
+    float mieScaleHeight;
+
+    void computeParameters();
+
+    void precompute();
+
+    void precomputeTransmittance(int rowBegin, int rowEnd);
+
+    void precomputeScattering(int sliceBegin, int sliceEnd);
+
+    glm::vec3 transmittanceToTop(float r, float mu) const;
+
+    // Everything the tables depend on, so any change recomputes them
+    void fillCacheHeader(CacheHeader &header) const;
+
+    bool loadCache();
+
+    void saveCache() const;
+};
+
+#endif
@@ -25,77 +25,53 @@ struct triangle {
                                                                            vertex3(vertex3) {}
 };
 
-void EclipseMap::createSphere(int radius, glm::vec3 pos, vector<float>& vertices, vector<int>& indices)
-{
-    for (int i = 0; i <= verticalSplitCount; i++) {
-        float b = M_PI*i/verticalSplitCount;
-
-        for (int j = 0; j <= horizontalSplitCount; j++) {
-            float a = 2*M_PI*j/horizontalSplitCount;
-
-            float x = radius*sin(b)*cos(a)+pos.x;
-            float y = radius*sin(b)*sin(a)+pos.y;
-            float z = radius*cos(b)+pos.z;
-
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-
-            glm::vec3 n = glm::vec3(x,y,z)-pos;
-            n = glm::normalize(n);
-            vertices.push_back(n.x);
-            vertices.push_back(n.y);
-            vertices.push_back(n.z);
-
-            vertices.push_back(((float)j)/horizontalSplitCount);
-            vertices.push_back(((float)i)/verticalSplitCount);
-        }
-    }
-
-    for (int i = 0; i < verticalSplitCount; i++) {
-        int k1 = i*(horizontalSplitCount+1);
-        int k2 = k1+horizontalSplitCount+1;
-
-        for (int j = 0; j < horizontalSplitCount; j++, k1++, k2++) {
-            if (i != 0) {
-                indices.push_back(k1);
-                indices.push_back(k2);
-                indices.push_back(k1+1);
-            }
-
-            if (i != (verticalSplitCount-1)) {
-                indices.push_back(k1+1);
-                indices.push_back(k2);
-                indices.push_back(k2+1);
-            }
-        }
+void EclipseMap::Render(const char *coloredTexturePath, const char *greyTexturePath, const char *moonTexturePath,
+                        const char *scenePath) {
+    // Scene settings, meshes and bodies, mapped from the compiled scene
+    if (!scene.load(scenePath)) {
+        printf("Cannot load scene %s\n", scenePath);
+        return;
     }
-}
+    printf("Scene %s loaded in %.2f ms, %d bodies, %zu KB\n", scenePath, scene.lastLoadTime(), scene.bodyCount(),
+           scene.size()/1024);
+
+    const SceneSettings &settings = scene.settings();
+    radius = settings.radius;
+    atmosphereHeight = settings.atmosphereHeight;
+    earthSpinRate = settings.earthSpinRate;
+    lightPos = settings.lightPos;
+    cameraStartPosition = settings.cameraStartPosition;
+    cameraStartDirection = settings.cameraStartDirection;
+    cameraStartUp = settings.cameraStartUp;
+    cameraPosition = cameraStartPosition;
+    cameraDirection = cameraStartDirection;
+    cameraUp = cameraStartUp;
 
-void EclipseMap::Render(const char *coloredTexturePath, const char *greyTexturePath, const char *moonTexturePath) {
     // Open window
     GLFWwindow *window = openWindow(windowName, screenWidth, screenHeight);
 
+    resources.init(&state);
+    resources.vramBudget = vramBudget;
+
     // Moon commands
     // Load shaders
-    GLuint moonShaderID = initShaders("moonShader.vert", "moonShader.frag");
+    ResourceHandle moonShader = resources.adoptProgram("moon shader", initShaders("moonShader.vert", "moonShader.frag"));
+    GLuint moonShaderID = moonShader.name();
 
-    glActiveTexture(GL_TEXTURE2);
-    initMoonColoredTexture(moonTexturePath, moonShaderID);
+    initMoonColoredTexture(moonTexturePath);
 
-    // Set moonVertices
-    createSphere(moonRadius, glm::vec3(0,0,0), moonVertices, moonIndices);
+    // The moon mesh is shared by every orbiting body
+    moonIndexCount = scene.indexCount(SceneFile::moonMesh);
 
     // Configure Buffers
-    GLuint mv_size = moonVertices.size()*sizeof(float);
-    GLuint mi_size = moonIndices.size()*sizeof(int);
+    GLuint mv_size = scene.vertexBytes(SceneFile::moonMesh);
+    GLuint mi_size = moonIndexCount*sizeof(int);
 
-    glGenBuffers(1, &moonVBO);
-    glGenVertexArrays(1, &moonVAO);
+    moonVBO = resources.createBuffer("moon vertices");
+    moonVAO = resources.createVertexArray("moon");
 
-    glBindVertexArray(moonVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, moonVBO);
-    glBufferData(GL_ARRAY_BUFFER, mv_size, moonVertices.data(), GL_DYNAMIC_DRAW);
+    state.bindVertexArray(moonVAO.name());
+    resources.bufferData(moonVBO, GL_ARRAY_BUFFER, mv_size, scene.vertices(SceneFile::moonMesh), GL_DYNAMIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)0);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)(sizeof(float)*3));
@@ -105,47 +81,52 @@ void EclipseMap::Render(const char *coloredTexturePath, const char *greyTextureP
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
-    glGenBuffers(1, &moonEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, moonEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mi_size, moonIndices.data(), GL_DYNAMIC_DRAW);
+    moonEBO = resources.createBuffer("moon indices");
+    resources.bufferData(moonEBO, GL_ELEMENT_ARRAY_BUFFER, mi_size, scene.indices(SceneFile::moonMesh), GL_DYNAMIC_DRAW);
+
+    // One model matrix per orbiting body, a mat4 attribute takes four locations
+    moonInstanceVBO = resources.createBuffer("moon instances");
+    glBindBuffer(GL_ARRAY_BUFFER, moonInstanceVBO.name());
+    for (int i = 0; i < 4; i++) {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(sizeof(glm::vec4)*i));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
 
+    state.useProgram(moonShaderID);
+    state.uniform1i(glGetUniformLocation(moonShaderID, "MoonTexColor"), moonColorUnit);
     GLint moon_lightPos_id = glGetUniformLocation(moonShaderID, "lightPosition");
-    glUniform3fv(moon_lightPos_id, 1, glm::value_ptr(lightPos));
+    state.uniform3fv(moon_lightPos_id, glm::value_ptr(lightPos));
     GLint moon_camPos_id = glGetUniformLocation(moonShaderID, "cameraPosition");
     GLint moon_img_w = glGetUniformLocation(moonShaderID, "imageWidth");
-    glUniform1f(moon_img_w, (GLfloat) moonImageWidth);
+    state.uniform1f(moon_img_w, (GLfloat) moonImageWidth);
     GLint moon_img_h = glGetUniformLocation(moonShaderID, "imageHeight");
-    glUniform1f(moon_img_h, (GLfloat) moonImageHeight);
+    state.uniform1f(moon_img_h, (GLfloat) moonImageHeight);
     GLint moon_pMat_id = glGetUniformLocation(moonShaderID, "ProjectionMatrix");
     GLint moon_viewMat_id = glGetUniformLocation(moonShaderID, "ViewMatrix");
-    GLint moon_normalMat_id = glGetUniformLocation(moonShaderID, "NormalMatrix");
-    GLint moon_mvp_id = glGetUniformLocation(moonShaderID, "MVP");
-    GLint moon_orbitd_id = glGetUniformLocation(moonShaderID, "orbitDegree");
 
 
     // World commands
     // Load shaders
-    GLuint worldShaderID = initShaders("worldShader.vert", "worldShader.frag");
+    ResourceHandle worldShader = resources.adoptProgram("world shader",
+                                                        initShaders("worldShader.vert", "worldShader.frag"));
+    GLuint worldShaderID = worldShader.name();
 
-    glActiveTexture(GL_TEXTURE0);
-    initColoredTexture(coloredTexturePath, worldShaderID);
+    initColoredTexture(coloredTexturePath);
 
-    glActiveTexture(GL_TEXTURE1);
-    initGreyTexture(greyTexturePath, worldShaderID);
+    initGreyTexture(greyTexturePath);
 
-    // Set worldVertices
-    createSphere(radius, glm::vec3(0,0,0), worldVertices, worldIndices);
+    worldIndexCount = scene.indexCount(SceneFile::worldMesh);
 
     // Configure Buffers
-    GLuint wv_size = worldVertices.size()*sizeof(float);
-    GLuint wi_size = worldIndices.size()*sizeof(int);
+    GLuint wv_size = scene.vertexBytes(SceneFile::worldMesh);
+    GLuint wi_size = worldIndexCount*sizeof(int);
 
-    glGenBuffers(1, &VBO);
-    glGenVertexArrays(1, &VAO);
+    VBO = resources.createBuffer("world vertices");
+    VAO = resources.createVertexArray("world");
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, wv_size, worldVertices.data(), GL_DYNAMIC_DRAW);
+    state.bindVertexArray(VAO.name());
+    resources.bufferData(VBO, GL_ARRAY_BUFFER, wv_size, scene.vertices(SceneFile::worldMesh), GL_DYNAMIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)0);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)(sizeof(float)*3));
@@ -155,181 +136,466 @@ void EclipseMap::Render(const char *coloredTexturePath, const char *greyTextureP
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
-    glGenBuffers(1, &EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, wi_size, worldIndices.data(), GL_DYNAMIC_DRAW);
+    EBO = resources.createBuffer("world indices");
+    resources.bufferData(EBO, GL_ELEMENT_ARRAY_BUFFER, wi_size, scene.indices(SceneFile::worldMesh), GL_DYNAMIC_DRAW);
+    resources.setHostMemory("height picker", heightPicker.memoryUsage());
 
+    state.useProgram(worldShaderID);
+    state.uniform1i(glGetUniformLocation(worldShaderID, "TexColor"), colorUnit);
+    state.uniform1i(glGetUniformLocation(worldShaderID, "TexGrey"), greyUnit);
     GLint world_lightPos_id = glGetUniformLocation(worldShaderID, "lightPosition");
-    glUniform3fv(world_lightPos_id, 1, glm::value_ptr(lightPos));
+    state.uniform3fv(world_lightPos_id, glm::value_ptr(lightPos));
     GLint world_camPos_id = glGetUniformLocation(worldShaderID, "cameraPosition");
     GLint world_height_f = glGetUniformLocation(worldShaderID, "heightFactor");
     GLint world_img_w = glGetUniformLocation(worldShaderID, "imageWidth");
-    glUniform1f(world_img_w, (GLfloat) imageWidth);
+    state.uniform1f(world_img_w, (GLfloat) imageWidth);
     GLint world_img_h = glGetUniformLocation(worldShaderID, "imageHeight");
-    glUniform1f(world_img_h, (GLfloat) imageHeight);
+    state.uniform1f(world_img_h, (GLfloat) imageHeight);
     GLint world_pMat_id = glGetUniformLocation(worldShaderID, "ProjectionMatrix");
     GLint world_viewMat_id = glGetUniformLocation(worldShaderID, "ViewMatrix");
     GLint world_normalMat_id = glGetUniformLocation(worldShaderID, "NormalMatrix");
     GLint world_mvp_id = glGetUniformLocation(worldShaderID, "MVP");
 
-    float E = 0.0;
-    float dE = 0.5/horizontalSplitCount;
-    float dO = glm::radians(0.02);
+    // Atmosphere, baked on the CPU or read back from its cache
+    atmosphere.planetRadius = radius;
+    atmosphere.atmosphereHeight = atmosphereHeight;
+    atmosphere.lutScale = atmosphereLutScale;
+    atmosphere.cachePath = string(scenePath) + ".lut";
+    atmosphere.init();
+    atmosphere.upload(&resources, transmittanceUnit, scatteringUnit);
+    atmosphere.printInfo(cout);
+
+    atmosphere.setUniforms(&state, worldShaderID, transmittanceUnit, scatteringUnit);
+    GLint world_atmosphere_id = glGetUniformLocation(worldShaderID, "atmosphereEnabled");
+
+    // Sky commands
+    // Load shaders
+    ResourceHandle skyShader = resources.adoptProgram("sky shader", initShaders("skyShader.vert", "skyShader.frag"));
+    GLuint skyShaderID = skyShader.name();
+
+    // The sky is a shell at the top of the atmosphere
+    skyIndexCount = scene.indexCount(SceneFile::skyMesh);
+
+    // Configure Buffers
+    GLuint sv_size = scene.vertexBytes(SceneFile::skyMesh);
+    GLuint si_size = skyIndexCount*sizeof(int);
+
+    skyVBO = resources.createBuffer("sky vertices");
+    skyVAO = resources.createVertexArray("sky");
+
+    state.bindVertexArray(skyVAO.name());
+    resources.bufferData(skyVBO, GL_ARRAY_BUFFER, sv_size, scene.vertices(SceneFile::skyMesh), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)0);
+    glEnableVertexAttribArray(0);
+
+    skyEBO = resources.createBuffer("sky indices");
+    resources.bufferData(skyEBO, GL_ELEMENT_ARRAY_BUFFER, si_size, scene.indices(SceneFile::skyMesh), GL_STATIC_DRAW);
+
+    state.useProgram(skyShaderID);
+    atmosphere.setUniforms(&state, skyShaderID, transmittanceUnit, scatteringUnit);
+    state.uniform3fv(glGetUniformLocation(skyShaderID, "lightPosition"), glm::value_ptr(lightPos));
+    GLint sky_camPos_id = glGetUniformLocation(skyShaderID, "cameraPosition");
+    GLint sky_pMat_id = glGetUniformLocation(skyShaderID, "ProjectionMatrix");
+    GLint sky_viewMat_id = glGetUniformLocation(skyShaderID, "ViewMatrix");
+
+    for (int i = 0; i < scene.bodyCount(); i++)
+        orbits.addBody(scene.body(i));
+
+    // Everything the scene holds is on the GPU or in the propagator now
+    scene.close();
+
+    // Offscreen scene target and its resolution controller
+    sceneTarget.init(&state, &resources);
+    resolutionController.targetFrameTime = targetFrameTime;
+    resolutionController.init();
 
     // Enable depth test
-    glEnable(GL_DEPTH_TEST);
+    state.enable(GL_DEPTH_TEST);
+
+    glClearStencil(0);
+    glClearDepth(1.0f);
+    glClearColor(0, 0, 0, 1);
+
+    // The sky is added on top of whatever is behind it
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    double lastFrameTime = glfwGetTime();
 
     // Main rendering loop
     do {
-        glfwGetWindowSize(window, &screenWidth, &screenHeight);
-        glViewport(0, 0, screenWidth, screenHeight);
-
-        glClearStencil(0);
-        glClearDepth(1.0f);
-        glClearColor(0, 0, 0, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        if (onDemandRendering) {
+            // Sleep until input arrives or the next capped animation frame is due
+            double frameInterval = 1.0/animationRate;
+            if (isAnimating())
+                glfwWaitEventsTimeout(max(0.0, lastFrameTime + frameInterval - glfwGetTime()));
+            else if (!redrawRequested && commandQueue.empty())
+                glfwWaitEvents();
+
+            bool frameDue = isAnimating() && glfwGetTime() - lastFrameTime >= frameInterval;
+            if (!frameDue && !redrawRequested && commandQueue.empty())
+                continue;
+        } else
+            glfwPollEvents();
+
+        // Animation and held keys advance with wall time; a long idle gap
+        // counts as a single frame so nothing jumps after waking up
+        double now = glfwGetTime();
+        double elapsed = now - lastFrameTime;
+        lastFrameTime = now;
+        if (elapsed > maxFrameGap)
+            elapsed = 1.0/referenceFrameRate;
+        frameSteps = elapsed*referenceFrameRate;
+        redrawRequested = false;
+        state.beginFrame();
+        resources.beginFrame();
+
+        if (animationEnabled)
+            simulationTime += frameSteps/referenceFrameRate*timeWarp;
+
+        glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+
+        // Minimized, nothing to draw into
+        if (screenWidth == 0 || screenHeight == 0) {
+            glfwWaitEvents();
+            continue;
+        }
 
         handleKeyPress(window);
 
-        glUseProgram(moonShaderID);
+        float renderScale = dynamicResolution ? resolutionController.scale() : 1;
+        int renderWidth = max(1, (int) (screenWidth*renderScale));
+        int renderHeight = max(1, (int) (screenHeight*renderScale));
+
+        sceneTarget.resize(screenWidth, screenHeight, antiAliasing);
+
+        resolutionController.beginFrame();
+        sceneTarget.begin(renderWidth, renderHeight);
+
+        state.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+        state.useProgram(moonShaderID);
+        resources.bindTexture(moonColorUnit, moonTextureColor);
 
         aspectRatio = ((float) screenWidth)/((float) screenHeight);
         glm::mat4 perspectiveMatrix = glm::perspective(glm::radians(projectionAngle), aspectRatio, near, far);
         glm::mat4 camMatrix = glm::lookAt(cameraPosition, cameraDirection, cameraUp);
 
-        glm::mat4 moonModellingMatrix = glm::rotate(glm::mat4(1), E, glm::vec3(0,0,1));
-        glm::mat4 moonNormalMatrix = moonModellingMatrix;
-        moonModellingMatrix = glm::translate(glm::mat4(1), glm::vec3(0,2600,0)) * moonModellingMatrix;
-
-        glUniformMatrix4fv(moon_normalMat_id, 1, GL_FALSE, glm::value_ptr(moonNormalMatrix));
-        glUniformMatrix4fv(moon_mvp_id, 1, GL_FALSE, glm::value_ptr(moonModellingMatrix));
-        glUniform1f(moon_orbitd_id, (GLfloat) -orbitDegree);
+        state.uniform3fv(moon_camPos_id, glm::value_ptr(cameraPosition));
 
-        glUniform3fv(moon_camPos_id, 1, glm::value_ptr(cameraPosition));
+        state.uniformMatrix4fv(moon_pMat_id, glm::value_ptr(perspectiveMatrix));
+        state.uniformMatrix4fv(moon_viewMat_id, glm::value_ptr(camMatrix));
 
-        glUniformMatrix4fv(moon_pMat_id, 1, GL_FALSE, glm::value_ptr(perspectiveMatrix));
-        glUniformMatrix4fv(moon_viewMat_id, 1, GL_FALSE, glm::value_ptr(camMatrix));
+        // Orbits are closed form in time, so this is the same cost for any date
+        orbits.propagate(simulationTime);
+        const vector<glm::mat4> &moonTransforms = orbits.transforms();
 
-        orbitDegree += dO;
-        if (orbitDegree >= 2*M_PI)
-            orbitDegree = 0;
+        // Orphan the old storage instead of waiting for the GPU to finish with it
+        GLsizeiptr instanceSize = moonTransforms.size()*sizeof(glm::mat4);
+        resources.bufferData(moonInstanceVBO, GL_ARRAY_BUFFER, instanceSize, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceSize, moonTransforms.data());
 
-        glBindVertexArray(moonVAO);
+        state.bindVertexArray(moonVAO.name());
 
-        glDrawElements(GL_TRIANGLES, moonVertices.size(), GL_UNSIGNED_INT, (void*)0);
+        state.drawElementsInstanced(GL_TRIANGLES, moonIndexCount, GL_UNSIGNED_INT, (void*)0, orbits.size());
         /*************************/
 
-        glUseProgram(worldShaderID);
+        state.useProgram(worldShaderID);
+        resources.bindTexture(colorUnit, textureColor);
+        resources.bindTexture(greyUnit, textureGrey);
 
+        float E = fmod(earthSpinRate*simulationTime, 2*M_PI);
+        worldSpin = E;
+        lastViewProjection = perspectiveMatrix*camMatrix;
         glm::mat4 worldModellingMatrix = glm::rotate(glm::mat4(1), E, glm::vec3(0,0,1));
         glm::mat4 worldNormalMatrix = worldModellingMatrix;
 
-        glUniformMatrix4fv(world_mvp_id, 1, GL_FALSE, glm::value_ptr(worldModellingMatrix));
-        glUniformMatrix4fv(world_normalMat_id, 1, GL_FALSE, glm::value_ptr(worldNormalMatrix));
-        glUniform1f(world_height_f, (GLfloat) heightFactor);
+        state.uniformMatrix4fv(world_mvp_id, glm::value_ptr(worldModellingMatrix));
+        state.uniformMatrix4fv(world_normalMat_id, glm::value_ptr(worldNormalMatrix));
+        state.uniform1f(world_height_f, (GLfloat) heightFactor);
+        state.uniform1i(world_atmosphere_id, atmosphereEnabled);
 
-        glUniform3fv(world_camPos_id, 1, glm::value_ptr(cameraPosition));
+        state.uniform3fv(world_camPos_id, glm::value_ptr(cameraPosition));
 
-        glUniformMatrix4fv(world_pMat_id, 1, GL_FALSE, glm::value_ptr(perspectiveMatrix));
-        glUniformMatrix4fv(world_viewMat_id, 1, GL_FALSE, glm::value_ptr(camMatrix));
+        state.uniformMatrix4fv(world_pMat_id, glm::value_ptr(perspectiveMatrix));
+        state.uniformMatrix4fv(world_viewMat_id, glm::value_ptr(camMatrix));
 
-        E += dE;
-        if (E >= 2*M_PI)
-            E = 0.0;
+        resources.bindTexture(transmittanceUnit, atmosphere.transmittanceTexture());
+        resources.bindTexture(scatteringUnit, atmosphere.scatteringTexture());
 
-        cameraPosition += glm::normalize(cameraDirection - cameraPosition)*speed;
+        state.bindVertexArray(VAO.name());
 
-        glBindVertexArray(VAO);
+        state.drawElements(GL_TRIANGLES, worldIndexCount, GL_UNSIGNED_INT, (void*)0);
 
-        glDrawElements(GL_TRIANGLES, worldVertices.size(), GL_UNSIGNED_INT, (void*)0);
+        // Sky shell last, so the depth test hides it behind the planet
+        if (atmosphereEnabled) {
+            state.useProgram(skyShaderID);
+            state.uniform3fv(sky_camPos_id, glm::value_ptr(cameraPosition));
+            state.uniformMatrix4fv(sky_pMat_id, glm::value_ptr(perspectiveMatrix));
+            state.uniformMatrix4fv(sky_viewMat_id, glm::value_ptr(camMatrix));
+
+            state.enable(GL_BLEND);
+            state.depthMask(false);
+            state.bindVertexArray(skyVAO.name());
+            state.drawElements(GL_TRIANGLES, skyIndexCount, GL_UNSIGNED_INT, (void*)0);
+            state.depthMask(true);
+            state.disable(GL_BLEND);
+        }
 
-        // Swap buffers and poll events
+        cameraPosition += glm::normalize(cameraDirection - cameraPosition)*(speed*frameSteps);
+
+        // Resolve and upscale the scene to the window
+        sceneTarget.end();
+        sceneTarget.present(screenWidth, screenHeight, upscaleFilter);
+
+        resolutionController.endFrame();
+        resolutionController.update();
+
+        // Textures drawn this frame are the last to be shrunk
+        resources.enforceBudget();
+
+        // Swap buffers, events are handled at the top of the loop
         glfwSwapBuffers(window);
-        glfwPollEvents();
     } while (!glfwWindowShouldClose(window));
 
-    // Delete buffers
-    glDeleteBuffers(1, &moonVAO);
-    glDeleteBuffers(1, &moonVBO);
-    glDeleteBuffers(1, &moonEBO);
-
+    state.printTotalStats(cout);
 
-    // Delete buffers
-    glDeleteBuffers(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+    atmosphere.destroy();
+    sceneTarget.destroy();
+    resolutionController.destroy();
 
-    glDeleteProgram(moonShaderID);
-    glDeleteProgram(worldShaderID);
+    // Everything else the manager created, while the context still exists
+    resources.releaseAll();
 
     // Close window
     glfwTerminate();
 }
 
+void EclipseMap::keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    EclipseMap *map = (EclipseMap *) glfwGetWindowUserPointer(window);
+    if (key < 0 || key > GLFW_KEY_LAST || action == GLFW_REPEAT)
+        return;
+
+    map->heldKeys[key] = action == GLFW_PRESS;
+    map->redrawRequested = true;
+
+    if (action != GLFW_PRESS)
+        return;
+
+    switch (key) {
+        case GLFW_KEY_ESCAPE: map->commandQueue.push_back(closeWindow); break;
+        case GLFW_KEY_P: map->commandQueue.push_back(toggleFullScreen); break;
+        case GLFW_KEY_X: map->commandQueue.push_back(stopCamera); break;
+        case GLFW_KEY_I: map->commandQueue.push_back(resetCamera); break;
+        case GLFW_KEY_M: map->commandQueue.push_back(cycleAntiAliasing); break;
+        case GLFW_KEY_U: map->commandQueue.push_back(toggleUpscaleFilter); break;
+        case GLFW_KEY_G: map->commandQueue.push_back(toggleDynamicResolution); break;
+        case GLFW_KEY_O: map->commandQueue.push_back(toggleOnDemandRendering); break;
+        case GLFW_KEY_COMMA: map->commandQueue.push_back(slowDownTime); break;
+        case GLFW_KEY_PERIOD: map->commandQueue.push_back(speedUpTime); break;
+        case GLFW_KEY_LEFT_BRACKET: map->commandQueue.push_back(jumpBackward); break;
+        case GLFW_KEY_RIGHT_BRACKET: map->commandQueue.push_back(jumpForward); break;
+        case GLFW_KEY_C: map->commandQueue.push_back(printCallStats); break;
+        case GLFW_KEY_SPACE: map->commandQueue.push_back(toggleAnimation); break;
+        case GLFW_KEY_K: map->commandQueue.push_back(toggleAtmosphere); break;
+        case GLFW_KEY_V: map->commandQueue.push_back(printMemoryReport); break;
+    }
+}
+
+void EclipseMap::mouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
+{
+    EclipseMap *map = (EclipseMap *) glfwGetWindowUserPointer(window);
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        map->commandQueue.push_back(pickSurface);
+        map->redrawRequested = true;
+    }
+}
+
+void EclipseMap::framebufferSizeCallback(GLFWwindow *window, int width, int height)
+{
+    EclipseMap *map = (EclipseMap *) glfwGetWindowUserPointer(window);
+    map->redrawRequested = true;
+}
+
+void EclipseMap::windowRefreshCallback(GLFWwindow *window)
+{
+    EclipseMap *map = (EclipseMap *) glfwGetWindowUserPointer(window);
+    map->redrawRequested = true;
+}
+
+bool EclipseMap::isAnimating()
+{
+    if (animationEnabled || speed != 0)
+        return true;
+
+    // Only the keys handleKeyPress acts on while held: height factor,
+    // camera pitch, yaw and speed
+    static const int heldControls[] = {
+        GLFW_KEY_R, GLFW_KEY_F, GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Y, GLFW_KEY_H
+    };
+    for (size_t i = 0; i < sizeof(heldControls)/sizeof(heldControls[0]); i++)
+        if (heldKeys[heldControls[i]])
+            return true;
+
+    return false;
+}
+
 void EclipseMap::handleKeyPress(GLFWwindow *window)
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    // One-shot commands queued by keyCallback
+    for (size_t i = 0; i < commandQueue.size(); i++) {
+        switch (commandQueue[i]) {
+            case closeWindow:
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                break;
+            case toggleFullScreen:
+                if (displayFormat == displayFormatOptions::windowed) {
+                    GLFWmonitor* primary = glfwGetPrimaryMonitor();
+
+                    screenWidth = glfwGetVideoMode(primary)->width;
+                    screenHeight = glfwGetVideoMode(primary)->height;
+                    glfwSetWindowMonitor(window, primary, 0, 0, screenWidth, screenHeight, GLFW_DONT_CARE);
+
+                    displayFormat = displayFormatOptions::fullScreen;
+                } else {
+                    screenWidth = defaultScreenWidth;
+                    screenHeight = defaultScreenHeight;
+                    glfwSetWindowMonitor(window, NULL, 1, 31, screenWidth, screenHeight, GLFW_DONT_CARE);
+
+                    displayFormat = displayFormatOptions::windowed;
+                }
+                break;
+            case stopCamera:
+                speed = 0;
+                break;
+            case resetCamera:
+                cameraDirection = cameraStartDirection;
+                cameraUp = cameraStartUp;
+                cameraPosition = cameraStartPosition;
+                speed = 0;
+                break;
+            case cycleAntiAliasing:
+                antiAliasing = (antiAliasing + 1) % (SceneTarget::fxaa + 1);
+                cout << "Anti-aliasing: " << SceneTarget::antiAliasingName(antiAliasing) << endl;
+                break;
+            case toggleUpscaleFilter:
+                upscaleFilter = upscaleFilter == SceneTarget::bilinear ? SceneTarget::sharpen : SceneTarget::bilinear;
+                cout << "Upscale filter: " << (upscaleFilter == SceneTarget::sharpen ? "sharpen" : "bilinear") << endl;
+                break;
+            case toggleDynamicResolution:
+                dynamicResolution = !dynamicResolution;
+                resolutionController.reset();
+                cout << "Dynamic resolution: " << (dynamicResolution ? "on" : "off") << endl;
+                break;
+            case toggleOnDemandRendering:
+                onDemandRendering = !onDemandRendering;
+                cout << "On-demand rendering: " << (onDemandRendering ? "on" : "off") << endl;
+                break;
+            case slowDownTime:
+                timeWarp /= 2;
+                cout << "Time warp: " << timeWarp << "x" << endl;
+                break;
+            case speedUpTime:
+                timeWarp *= 2;
+                cout << "Time warp: " << timeWarp << "x" << endl;
+                break;
+            case jumpBackward:
+                if (orbits.size() > 0)
+                    simulationTime -= orbits.period(0);
+                break;
+            case jumpForward:
+                if (orbits.size() > 0)
+                    simulationTime += orbits.period(0);
+                break;
+            case printCallStats:
+                state.printFrameStats(cout);
+                break;
+            case toggleAnimation:
+                animationEnabled = !animationEnabled;
+                cout << "Animation: " << (animationEnabled ? "on" : "off") << endl;
+                break;
+            case printMemoryReport:
+                resources.printReport(cout);
+                break;
+            case toggleAtmosphere:
+                atmosphereEnabled = !atmosphereEnabled;
+                cout << "Atmosphere: " << (atmosphereEnabled ? "on" : "off") << endl;
+                break;
+            case pickSurface:
+                pickUnderCursor(window);
+                break;
+        }
+    }
+    commandQueue.clear();
 
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
-        heightFactor += 10;
-    else if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && heightFactor >= 0)
-        heightFactor -= 10;
+    // Held keys act every frame, scaled to the nominal frame rate
+    if (heldKeys[GLFW_KEY_R])
+        heightFactor += 10*frameSteps;
+    else if (heldKeys[GLFW_KEY_F] && heightFactor >= 0)
+        heightFactor -= 10*frameSteps;
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+    if (heldKeys[GLFW_KEY_W]) {
         glm::vec3 left = glm::normalize(glm::cross(cameraDirection - cameraPosition, cameraUp));
-        float s = glm::radians(0.05);
+        float s = glm::radians(0.05)*frameSteps;
         glm::mat3 r_m = glm::rotate(glm::mat4(1), s, left);
         cameraDirection = r_m * (cameraDirection - cameraPosition) + cameraPosition;
         cameraUp = glm::normalize(r_m * cameraUp);
-    } else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+    } else if (heldKeys[GLFW_KEY_S]) {
         glm::vec3 left = glm::normalize(glm::cross(cameraPosition - cameraDirection, cameraUp));
-        float s = glm::radians(0.05);
+        float s = glm::radians(0.05)*frameSteps;
         glm::mat3 r_m = glm::rotate(glm::mat4(1), s, left);
         cameraDirection = r_m * (cameraDirection - cameraPosition) + cameraPosition;
         cameraUp = glm::normalize(r_m * cameraUp);
     }
 
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        float s = glm::radians(0.05);
+    if (heldKeys[GLFW_KEY_A]) {
+        float s = glm::radians(0.05)*frameSteps;
         glm::mat3 r_m = glm::rotate(glm::mat4(1), s, cameraUp);
         cameraDirection = r_m * (cameraDirection - cameraPosition) + cameraPosition;
-    } else if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        float s = glm::radians(-0.05);
+    } else if (heldKeys[GLFW_KEY_D]) {
+        float s = glm::radians(-0.05)*frameSteps;
         glm::mat3 r_m = glm::rotate(glm::mat4(1), s, cameraUp);
         cameraDirection = r_m * (cameraDirection - cameraPosition) + cameraPosition;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS) {
-        speed += 0.01;
-    } else if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
-        speed -= 0.01;
-    } else if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
-        speed = 0;
-    } else if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
-        cameraDirection = cameraStartDirection;
-        cameraUp = cameraStartUp;
-        cameraPosition = cameraStartPosition;
-        speed = 0;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
-        if (displayFormat == displayFormatOptions::windowed && glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE) {
-            GLFWmonitor* primary = glfwGetPrimaryMonitor();
-
-            screenWidth = glfwGetVideoMode(primary)->width;
-            screenHeight = glfwGetVideoMode(primary)->height;
-            glfwSetWindowMonitor(window, primary, 0, 0, screenWidth, screenHeight, GLFW_DONT_CARE);
+    if (heldKeys[GLFW_KEY_Y])
+        speed += 0.01*frameSteps;
+    else if (heldKeys[GLFW_KEY_H])
+        speed -= 0.01*frameSteps;
+}
 
-            displayFormat = displayFormatOptions::fullScreen;
-        } else if(glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE) {
-            screenWidth = defaultScreenWidth;
-            screenHeight = defaultScreenHeight;
-            glfwSetWindowMonitor(window, NULL, 1, 31, screenWidth, screenHeight, GLFW_DONT_CARE);
+void EclipseMap::pickUnderCursor(GLFWwindow *window)
+{
+    // Cursor coordinates are in window units, which differ from pixels on HiDPI screens
+    double cursorX, cursorY;
+    int windowWidth, windowHeight;
+    glfwGetCursorPos(window, &cursorX, &cursorY);
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    if (windowWidth == 0 || windowHeight == 0)
+        return;
 
-            displayFormat = displayFormatOptions::windowed;
-        }
-    }
+    float x = 2*cursorX/windowWidth - 1;
+    float y = 1 - 2*cursorY/windowHeight;
+    glm::mat4 unproject = glm::inverse(lastViewProjection);
+    glm::vec4 nearPoint = unproject*glm::vec4(x, y, -1, 1);
+    glm::vec4 farPoint = unproject*glm::vec4(x, y, 1, 1);
+    glm::vec3 origin = glm::vec3(nearPoint.x, nearPoint.y, nearPoint.z)/nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint.x, farPoint.y, farPoint.z)/farPoint.w - origin;
+
+    // worldShader.vert displaces along normalize(NormalMatrix*vec4(n, 1)).xyz,
+    // which is the unit normal scaled by 1/sqrt(2)
+    heightPicker.setGlobe(radius, heightFactor/sqrt(2.0f), worldSpin);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    PickResult result = heightPicker.pick(origin, direction);
+    double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    if (result.hit)
+        printf("Picked latitude %.3f, longitude %.3f, elevation %.2f (height %.3f) in %.1f us\n",
+               result.latitude, result.longitude, result.elevation, result.height, elapsed);
+    else
+        printf("Nothing under the cursor (%.1f us)\n", elapsed);
 }
 
 GLFWwindow *EclipseMap::openWindow(const char *windowName, int width, int height)
@@ -340,7 +606,8 @@ GLFWwindow *EclipseMap::openWindow(const char *windowName, int width, int height
     }
 
     const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // Anti-aliasing is done on the offscreen scene target, see SceneTarget
+    glfwWindowHint(GLFW_SAMPLES, 0);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -363,19 +630,23 @@ GLFWwindow *EclipseMap::openWindow(const char *windowName, int width, int height
         return 0;
     }
 
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Input arrives through callbacks instead of polling every key per frame
+    glfwSetWindowUserPointer(window, this);
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetMouseButtonCallback(window, mouseButtonCallback);
+    glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+    glfwSetWindowRefreshCallback(window, windowRefreshCallback);
     glClearColor(0, 0, 0, 0);
 
     return window;
 }
 
 
-void EclipseMap::initColoredTexture(const char *filename, GLuint shader)
+void EclipseMap::initColoredTexture(const char *filename)
 {
     int width, height;
-    glGenTextures(1, &textureColor);
-    cout << shader << endl;
-    glBindTexture(GL_TEXTURE_2D, textureColor);
+    textureColor = resources.createTexture("earth color", true);
+    resources.bindTextureForEdit(colorUnit, textureColor);
     // set the texture wrapping parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
                     GL_CLAMP_TO_EDGE);    // set texture wrapping to GL_REPEAT (default wrapping method)
@@ -432,6 +703,7 @@ void EclipseMap::initColoredTexture(const char *filename, GLuint shader)
 
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, raw_image);
+    resources.textureStorage(textureColor, GL_TEXTURE_2D, GL_RGB, width, height, 1, true);
 
 
     imageWidth = width;
@@ -439,10 +711,6 @@ void EclipseMap::initColoredTexture(const char *filename, GLuint shader)
 
     glGenerateMipmap(GL_TEXTURE_2D);
 
-    glUseProgram(shader); // don't forget to activate/use the shader before setting uniforms!
-    // either set it manually like so:
-
-    glUniform1i(glGetUniformLocation(shader, "TexColor"), 0);
     /* wrap up decompression, destroy objects, free pointers and close open files */
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
@@ -452,10 +720,11 @@ void EclipseMap::initColoredTexture(const char *filename, GLuint shader)
 
 }
 
-void EclipseMap::initGreyTexture(const char *filename, GLuint shader)
+void EclipseMap::initGreyTexture(const char *filename)
 {
-    glGenTextures(1, &textureGrey);
-    glBindTexture(GL_TEXTURE_2D, textureGrey);
+    // Never shrunk: the picker marches a full resolution copy of these heights
+    textureGrey = resources.createTexture("earth height", false);
+    resources.bindTextureForEdit(greyUnit, textureGrey);
     // set the texture wrapping parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
                     GL_CLAMP_TO_EDGE);    // set texture wrapping to GL_REPEAT (default wrapping method)
@@ -512,16 +781,13 @@ void EclipseMap::initGreyTexture(const char *filename, GLuint shader)
     width = cinfo.image_width;
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, raw_image);
+    resources.textureStorage(textureGrey, GL_TEXTURE_2D, GL_RGB, width, height, 1, true);
 
-
-
+    // Cursor picking keeps its own copy of the heights
+    heightPicker.build(raw_image, width, height, cinfo.num_components);
 
     glGenerateMipmap(GL_TEXTURE_2D);
 
-    glUseProgram(shader); // don't forget to activate/use the shader before setting uniforms!
-    // either set it manually like so:
-
-    glUniform1i(glGetUniformLocation(shader, "TexGrey"), 1);
     /* wrap up decompression, destroy objects, free pointers and close open files */
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
@@ -531,12 +797,11 @@ void EclipseMap::initGreyTexture(const char *filename, GLuint shader)
 
 }
 
-void EclipseMap::initMoonColoredTexture(const char *filename, GLuint shader)
+void EclipseMap::initMoonColoredTexture(const char *filename)
 {
     int width, height;
-    glGenTextures(1, &moonTextureColor);
-    cout << shader << endl;
-    glBindTexture(GL_TEXTURE_2D, moonTextureColor);
+    moonTextureColor = resources.createTexture("moon color", true);
+    resources.bindTextureForEdit(moonColorUnit, moonTextureColor);
     // set the texture wrapping parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
                     GL_CLAMP_TO_EDGE);    // set texture wrapping to GL_REPEAT (default wrapping method)
@@ -593,6 +858,7 @@ void EclipseMap::initMoonColoredTexture(const char *filename, GLuint shader)
 
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, raw_image);
+    resources.textureStorage(moonTextureColor, GL_TEXTURE_2D, GL_RGB, width, height, 1, true);
 
 
     moonImageWidth = width;
@@ -600,10 +866,6 @@ void EclipseMap::initMoonColoredTexture(const char *filename, GLuint shader)
 
     glGenerateMipmap(GL_TEXTURE_2D);
 
-    glUseProgram(shader); // don't forget to activate/use the shader before setting uniforms!
-    // either set it manually like so:
-
-    glUniform1i(glGetUniformLocation(shader, "MoonTexColor"), 2);
     /* wrap up decompression, destroy objects, free pointers and close open files */
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
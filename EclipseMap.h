@@ -2,10 +2,20 @@
 #define ECLIPSEMAP_H
 
 #include <vector>
+#include <algorithm>
+#include <chrono>
 #include <GL/glew.h>
 #include <iostream>
 #include "../glm/glm/ext.hpp"
 #include "Shader.h"
+#include "SceneTarget.h"
+#include "ResolutionController.h"
+#include "GLState.h"
+#include "OrbitPropagator.h"
+#include "Atmosphere.h"
+#include "HeightPicker.h"
+#include "ResourceManager.h"
+#include "SceneFile.h"
 #include <vector>
 #include "../glm/glm/glm.hpp"
 #include <GLFW/glfw3.h>
@@ -18,11 +28,46 @@ using namespace std;
 
 class EclipseMap {
 private:
+    // RESOURCE SETTINGS
+    // Declared first so it outlives every handle below
+    ResourceManager resources;
+    size_t vramBudget = 0; // bytes, 0 for no limit; over it the least recently used textures are shrunk, see setVramBudget
     float heightFactor = 80;
     float textureOffset = 0;
-    float orbitDegree = 0;
-    glm::vec3 lightPos = glm::vec3(0, 4000, 0);
-    bool pKeyPressed = false;
+    glm::vec3 lightPos;
+    // SCENE SETTINGS
+    SceneFile scene; // mapped only while Render sets up
+    double earthSpinRate = 0; // radians per second
+    // INPUT SETTINGS
+    enum inputCommands {
+        closeWindow, toggleFullScreen, stopCamera, resetCamera, cycleAntiAliasing, toggleUpscaleFilter,
+        toggleDynamicResolution, toggleOnDemandRendering, toggleAnimation, printCallStats,
+        slowDownTime, speedUpTime, jumpBackward, jumpForward, toggleAtmosphere, pickSurface,
+        printMemoryReport
+    };
+    vector<int> commandQueue;
+    bool heldKeys[GLFW_KEY_LAST + 1] = {};
+    // FRAME PACING SETTINGS
+    bool onDemandRendering = false;
+    bool animationEnabled = true;
+    bool redrawRequested = true;
+    float animationRate = 30; // frames per second while animating on demand
+    float referenceFrameRate = 60; // rate the per-frame animation steps were tuned for
+    float maxFrameGap = 0.25; // s
+    float frameSteps = 1;
+    // SIMULATION SETTINGS
+    double simulationTime = 0; // s
+    double timeWarp = 1;
+    OrbitPropagator orbits;
+    // ATMOSPHERE SETTINGS
+    bool atmosphereEnabled = true;
+    float atmosphereHeight = 0; // from the scene
+    float atmosphereLutScale = 1; // LUT resolution, memory grows with its cube
+    Atmosphere atmosphere;
+    // PICKING SETTINGS
+    HeightPicker heightPicker;
+    glm::mat4 lastViewProjection = glm::mat4(1); // what is on screen, for unprojecting the cursor
+    float worldSpin = 0;
     // DISPLAY SETTINGS
     enum displayFormatOptions {
         windowed = 1, fullScreen = 0
@@ -33,6 +78,18 @@ private:
     int screenWidth = defaultScreenWidth;
     int screenHeight = defaultScreenHeight;
     int displayFormat = displayFormatOptions::windowed;
+    // RESOLUTION SETTINGS
+    bool dynamicResolution = true;
+    float targetFrameTime = 1000.0/60; // ms
+    int antiAliasing = SceneTarget::msaa4;
+    int upscaleFilter = SceneTarget::bilinear;
+    SceneTarget sceneTarget;
+    // GL STATE
+    enum textureUnits {
+        colorUnit = 0, greyUnit = 1, moonColorUnit = 2, transmittanceUnit = 3, scatteringUnit = 4
+    };
+    GLState state;
+    ResolutionController resolutionController;
     // CAMERA SETTINGS
     float projectionAngle = 45;
     float aspectRatio = 1;
@@ -44,49 +101,62 @@ private:
     float pitch = startPitch;
     float yaw = startYaw;
     float speed = startSpeed;
-    glm::vec3 cameraStartPosition = glm::vec3(0, 4000, 4000);
-    glm::vec3 cameraStartDirection = glm::vec3(0, -1, -1);
-    glm::vec3 cameraStartUp = glm::vec3(0, 0, 1);
-    glm::vec3 cameraUp = cameraStartUp;
-    glm::vec3 cameraPosition = cameraStartPosition;
-    glm::vec3 cameraDirection = cameraStartDirection;
-
-    void createSphere(int radius, glm::vec3 pos, vector<float>& vertices, vector<int>& indices);
+    // The start values come from the scene
+    glm::vec3 cameraStartPosition;
+    glm::vec3 cameraStartDirection;
+    glm::vec3 cameraStartUp;
+    glm::vec3 cameraUp;
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraDirection;
+
+    bool isAnimating();
+
+    static void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
+
+    static void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
+
+    static void framebufferSizeCallback(GLFWwindow *window, int width, int height);
+
+    static void windowRefreshCallback(GLFWwindow *window);
 public:
-    unsigned int textureColor;
-    unsigned int textureGrey;
-    unsigned int VAO;
-    unsigned int VBO, EBO;
+    ResourceHandle textureColor;
+    ResourceHandle textureGrey;
+    ResourceHandle VAO;
+    ResourceHandle VBO, EBO;
     float imageHeight;
     float imageWidth;
-    float radius = 600;
-    int horizontalSplitCount = 250;
-    int verticalSplitCount = 125;
+    float radius = 0;
+    int worldIndexCount = 0;
 
-    unsigned int moonTextureColor;
-    unsigned int moonVAO;
-    unsigned int moonVBO, moonEBO;
+    ResourceHandle moonTextureColor;
+    ResourceHandle moonVAO;
+    ResourceHandle moonVBO, moonEBO;
+    ResourceHandle moonInstanceVBO;
     float moonImageHeight;
     float moonImageWidth;
-    float moonRadius = 162;
-
-    vector<float> worldVertices;
-    vector<int> worldIndices;
+    int moonIndexCount = 0;
 
-    vector<float> moonVertices;
-    vector<int> moonIndices;
+    ResourceHandle skyVAO;
+    ResourceHandle skyVBO, skyEBO;
+    int skyIndexCount = 0;
 
     GLFWwindow *openWindow(const char *windowName, int width, int height);
 
-    void Render(const char *coloredTexturePath, const char *greyTexturePath, const char *moonTexturePath);
+    // Set before Render, e.g. from --vram-budget
+    void setVramBudget(size_t bytes) { vramBudget = bytes; }
+
+    void Render(const char *coloredTexturePath, const char *greyTexturePath, const char *moonTexturePath,
+                const char *scenePath);
 
     void handleKeyPress(GLFWwindow *window);
 
-    void initColoredTexture(const char *filename, GLuint shader);
+    void pickUnderCursor(GLFWwindow *window);
+
+    void initColoredTexture(const char *filename);
 
-    void initGreyTexture(const char *filename, GLuint shader);
+    void initGreyTexture(const char *filename);
 
-    void initMoonColoredTexture(const char *filename, GLuint shader);
+    void initMoonColoredTexture(const char *filename);
 
 };
 
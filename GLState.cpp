@@ -0,0 +1,311 @@
+#include <string.h>
+#include "GLState.h"
+
+using namespace std;
+
+GLState::GLState()
+{
+    invalidate();
+
+    memset(&currentFrame, 0, sizeof(currentFrame));
+    memset(&previousFrame, 0, sizeof(previousFrame));
+    memset(&total, 0, sizeof(total));
+    frameCount = 0;
+}
+
+void GLState::useProgram(GLuint program)
+{
+    bool changed = program != currentProgram;
+    if (changed) {
+        glUseProgram(program);
+        currentProgram = program;
+    }
+    count(programCalls, changed);
+}
+
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+    bool changed = vertexArray != currentVertexArray;
+    if (changed) {
+        glBindVertexArray(vertexArray);
+        currentVertexArray = vertexArray;
+    }
+    count(vertexArrayCalls, changed);
+}
+
+void GLState::bindTexture(int unit, GLenum target, GLuint texture)
+{
+    if (boundTextures[unit] == texture && boundTargets[unit] == target) {
+        count(textureCalls, false);
+        return;
+    }
+
+    if (unit != currentTextureUnit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        currentTextureUnit = unit;
+        count(textureCalls, true);
+    }
+
+    glBindTexture(target, texture);
+    boundTextures[unit] = texture;
+    boundTargets[unit] = target;
+    count(textureCalls, true);
+}
+
+void GLState::bindTextureForEdit(int unit, GLenum target, GLuint texture)
+{
+    bindTexture(unit, target, texture);
+
+    if (unit != currentTextureUnit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        currentTextureUnit = unit;
+        count(textureCalls, true);
+    }
+}
+
+void GLState::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    bool read = target == GL_READ_FRAMEBUFFER || target == GL_FRAMEBUFFER;
+    bool draw = target == GL_DRAW_FRAMEBUFFER || target == GL_FRAMEBUFFER;
+
+    bool changed = (read && readFramebuffer != framebuffer) || (draw && drawFramebuffer != framebuffer);
+    if (changed) {
+        glBindFramebuffer(target, framebuffer);
+        if (read)
+            readFramebuffer = framebuffer;
+        if (draw)
+            drawFramebuffer = framebuffer;
+    }
+    count(framebufferCalls, changed);
+}
+
+void GLState::viewport(int x, int y, int width, int height)
+{
+    bool changed = currentViewport[0] != x || currentViewport[1] != y ||
+                   currentViewport[2] != width || currentViewport[3] != height;
+    if (changed) {
+        glViewport(x, y, width, height);
+        currentViewport[0] = x;
+        currentViewport[1] = y;
+        currentViewport[2] = width;
+        currentViewport[3] = height;
+    }
+    count(framebufferCalls, changed);
+}
+
+void GLState::enable(GLenum capability)
+{
+    unordered_map<GLenum, bool>::iterator it = capabilities.find(capability);
+    bool changed = it == capabilities.end() || !it->second;
+    if (changed) {
+        glEnable(capability);
+        capabilities[capability] = true;
+    }
+    count(capabilityCalls, changed);
+}
+
+void GLState::disable(GLenum capability)
+{
+    unordered_map<GLenum, bool>::iterator it = capabilities.find(capability);
+    bool changed = it == capabilities.end() || it->second;
+    if (changed) {
+        glDisable(capability);
+        capabilities[capability] = false;
+    }
+    count(capabilityCalls, changed);
+}
+
+void GLState::depthMask(bool enabled)
+{
+    bool changed = currentDepthMask != (int) enabled;
+    if (changed) {
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+        currentDepthMask = enabled;
+    }
+    count(capabilityCalls, changed);
+}
+
+void GLState::uniform1i(GLint location, int value)
+{
+    // Stored bitwise, the cache only compares values
+    float data;
+    memcpy(&data, &value, sizeof(data));
+    if (updateUniform(location, &data, 1))
+        glUniform1i(location, value);
+}
+
+void GLState::uniform1f(GLint location, float value)
+{
+    if (updateUniform(location, &value, 1))
+        glUniform1f(location, value);
+}
+
+void GLState::uniform2f(GLint location, float x, float y)
+{
+    float data[2] = {x, y};
+    if (updateUniform(location, data, 2))
+        glUniform2f(location, x, y);
+}
+
+void GLState::uniform3fv(GLint location, const float *value)
+{
+    if (updateUniform(location, value, 3))
+        glUniform3fv(location, 1, value);
+}
+
+void GLState::uniformMatrix4fv(GLint location, const float *value)
+{
+    if (updateUniform(location, value, 16))
+        glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void GLState::drawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    glDrawElements(mode, count, type, indices);
+    this->count(drawCalls, true);
+}
+
+void GLState::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances)
+{
+    glDrawElementsInstanced(mode, count, type, indices, instances);
+    this->count(drawCalls, true);
+}
+
+void GLState::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    glDrawArrays(mode, first, count);
+    this->count(drawCalls, true);
+}
+
+void GLState::clear(GLbitfield mask)
+{
+    glClear(mask);
+    count(framebufferCalls, true);
+}
+
+void GLState::forgetProgram(GLuint program)
+{
+    if (currentProgram == program)
+        currentProgram = ~0u;
+
+    unordered_map<unsigned long long, UniformValue>::iterator it = uniforms.begin();
+    while (it != uniforms.end()) {
+        if ((GLuint) (it->first >> 32) == program)
+            it = uniforms.erase(it);
+        else
+            ++it;
+    }
+}
+
+void GLState::forgetVertexArray(GLuint vertexArray)
+{
+    if (currentVertexArray == vertexArray)
+        currentVertexArray = ~0u;
+}
+
+void GLState::forgetTexture(GLuint texture)
+{
+    for (int i = 0; i < textureUnitCount; i++)
+        if (boundTextures[i] == texture)
+            boundTextures[i] = ~0u;
+}
+
+void GLState::forgetFramebuffer(GLuint framebuffer)
+{
+    if (readFramebuffer == framebuffer)
+        readFramebuffer = ~0u;
+    if (drawFramebuffer == framebuffer)
+        drawFramebuffer = ~0u;
+}
+
+void GLState::invalidate()
+{
+    // ~0 is never a valid object name, so the next call always goes through
+    currentProgram = ~0u;
+    currentVertexArray = ~0u;
+    currentTextureUnit = -1;
+    for (int i = 0; i < textureUnitCount; i++) {
+        boundTextures[i] = ~0u;
+        boundTargets[i] = 0;
+    }
+    readFramebuffer = ~0u;
+    drawFramebuffer = ~0u;
+    for (int i = 0; i < 4; i++)
+        currentViewport[i] = -1;
+    capabilities.clear();
+    currentDepthMask = -1;
+    uniforms.clear();
+}
+
+void GLState::beginFrame()
+{
+    previousFrame = currentFrame;
+    memset(&currentFrame, 0, sizeof(currentFrame));
+    frameCount++;
+}
+
+void GLState::printFrameStats(ostream &out) const
+{
+    out << "GL calls last frame (issued/skipped):";
+    for (int i = 0; i < categoryCount; i++)
+        out << " " << categoryName(i) << " " << previousFrame.issued[i] << "/" << previousFrame.skipped[i];
+    out << endl;
+}
+
+void GLState::printTotalStats(ostream &out) const
+{
+    if (frameCount == 0)
+        return;
+
+    out << "GL calls per frame over " << frameCount << " frames (issued/skipped):";
+    for (int i = 0; i < categoryCount; i++)
+        out << " " << categoryName(i) << " " << (float) total.issued[i]/frameCount
+            << "/" << (float) total.skipped[i]/frameCount;
+    out << endl;
+}
+
+const char *GLState::categoryName(int category)
+{
+    switch (category) {
+        case programCalls: return "program";
+        case vertexArrayCalls: return "vertexArray";
+        case textureCalls: return "texture";
+        case uniformCalls: return "uniform";
+        case drawCalls: return "draw";
+        case framebufferCalls: return "framebuffer";
+        case capabilityCalls: return "capability";
+    }
+    return "unknown";
+}
+
+bool GLState::updateUniform(GLint location, const float *data, int size)
+{
+    // GL ignores location -1, so do we
+    if (location < 0) {
+        count(uniformCalls, false);
+        return false;
+    }
+
+    unsigned long long key = ((unsigned long long) currentProgram << 32) | (unsigned int) location;
+    UniformValue &cached = uniforms[key];
+    if (cached.size == size && memcmp(cached.data, data, size*sizeof(float)) == 0) {
+        count(uniformCalls, false);
+        return false;
+    }
+
+    cached.size = size;
+    memcpy(cached.data, data, size*sizeof(float));
+    count(uniformCalls, true);
+    return true;
+}
+
+void GLState::count(int category, bool issued)
+{
+    if (issued) {
+        currentFrame.issued[category]++;
+        total.issued[category]++;
+    } else {
+        currentFrame.skipped[category]++;
+        total.skipped[category]++;
+    }
+}
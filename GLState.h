@@ -0,0 +1,120 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <iostream>
+#include <unordered_map>
+#include <GL/glew.h>
+
+using namespace std;
+
+// Thin wrapper over the GL calls the renderer issues every frame. It keeps a
+// shadow copy of the bindings and uniform values it has set and skips calls
+// that would not change anything, counting issued and skipped calls per frame.
+// Everything that changes this state must go through here, or call
+// invalidate() afterwards.
+class GLState {
+public:
+    enum callCategories {
+        programCalls, vertexArrayCalls, textureCalls, uniformCalls, drawCalls, framebufferCalls, capabilityCalls,
+        categoryCount
+    };
+
+    struct CallCounts {
+        unsigned int issued[categoryCount];
+        unsigned int skipped[categoryCount];
+    };
+
+    GLState();
+
+    void useProgram(GLuint program);
+
+    void bindVertexArray(GLuint vertexArray);
+
+    void bindTexture(int unit, GLenum target, GLuint texture);
+
+    // bindTexture() that also leaves the unit active, for the glTex* calls
+    // that edit the texture next; a cached bind can skip glActiveTexture
+    void bindTextureForEdit(int unit, GLenum target, GLuint texture);
+
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+    void viewport(int x, int y, int width, int height);
+
+    void enable(GLenum capability);
+
+    void disable(GLenum capability);
+
+    void depthMask(bool enabled);
+
+    // Uniform setters apply to the program bound with useProgram()
+    void uniform1i(GLint location, int value);
+
+    void uniform1f(GLint location, float value);
+
+    void uniform2f(GLint location, float x, float y);
+
+    void uniform3fv(GLint location, const float *value);
+
+    void uniformMatrix4fv(GLint location, const float *value);
+
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+
+    void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances);
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count);
+
+    void clear(GLbitfield mask);
+
+    // Must be called before a GL object this class may have bound is deleted
+    void forgetProgram(GLuint program);
+
+    void forgetVertexArray(GLuint vertexArray);
+
+    void forgetTexture(GLuint texture);
+
+    void forgetFramebuffer(GLuint framebuffer);
+
+    // Drops all cached state, e.g. after GL calls made behind our back
+    void invalidate();
+
+    void beginFrame();
+
+    const CallCounts &lastFrame() const { return previousFrame; }
+
+    void printFrameStats(ostream &out) const;
+
+    void printTotalStats(ostream &out) const;
+
+    static const char *categoryName(int category);
+
+private:
+    static const int textureUnitCount = 16;
+
+    struct UniformValue {
+        int size;
+        float data[16];
+    };
+
+    GLuint currentProgram;
+    GLuint currentVertexArray;
+    int currentTextureUnit;
+    GLuint boundTextures[textureUnitCount];
+    GLenum boundTargets[textureUnitCount];
+    GLuint readFramebuffer;
+    GLuint drawFramebuffer;
+    int currentViewport[4];
+    unordered_map<GLenum, bool> capabilities;
+    int currentDepthMask;
+    unordered_map<unsigned long long, UniformValue> uniforms;
+
+    CallCounts currentFrame;
+    CallCounts previousFrame;
+    CallCounts total;
+    unsigned int frameCount;
+
+    bool updateUniform(GLint location, const float *data, int size);
+
+    void count(int category, bool issued);
+};
+
+#endif
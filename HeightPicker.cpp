@@ -0,0 +1,410 @@
+#include <stdlib.h>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "HeightPicker.h"
+
+using namespace std;
+
+static const float twoPi = 2*M_PI;
+static const float infinity = 1e30f;
+// Bisection steps once a texel brackets the surface
+static const int refineSteps = 12;
+// Shortest step through a texel, as a fraction of a texel's height; only
+// rays grazing the surface closer than this get down to it
+static const float minRefineStep = 1e-3f;
+
+void HeightPicker::build(const unsigned char *pixels, int width, int height, int components)
+{
+    mapWidth = width;
+    mapHeight = height;
+    heights.resize(width*height);
+    for (int i = 0; i < width*height; i++)
+        heights[i] = pixels[i*components]/255.0f;
+
+    levels.clear();
+
+    // The bilinear surface over a texel blends it with its eight neighbours,
+    // so the finest level bounds those
+    Level base;
+    base.width = width;
+    base.height = height;
+    base.minHeight.resize(width*height);
+    base.maxHeight.resize(width*height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float lo = 1, hi = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                int sy = min(max(y + dy, 0), height - 1);
+                for (int dx = -1; dx <= 1; dx++) {
+                    int sx = min(max(x + dx, 0), width - 1);
+                    lo = min(lo, heights[sy*width + sx]);
+                    hi = max(hi, heights[sy*width + sx]);
+                }
+            }
+            base.minHeight[y*width + x] = lo;
+            base.maxHeight[y*width + x] = hi;
+        }
+    }
+    levels.push_back(base);
+
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        const Level &fine = levels.back();
+        Level coarse;
+        coarse.width = (fine.width + 1)/2;
+        coarse.height = (fine.height + 1)/2;
+        coarse.minHeight.resize(coarse.width*coarse.height);
+        coarse.maxHeight.resize(coarse.width*coarse.height);
+
+        for (int y = 0; y < coarse.height; y++) {
+            int y0 = 2*y, y1 = min(2*y + 1, fine.height - 1);
+            for (int x = 0; x < coarse.width; x++) {
+                int x0 = 2*x, x1 = min(2*x + 1, fine.width - 1);
+                int a = y0*fine.width + x0, b = y0*fine.width + x1;
+                int c = y1*fine.width + x0, d = y1*fine.width + x1;
+                coarse.minHeight[y*coarse.width + x] = min(min(fine.minHeight[a], fine.minHeight[b]),
+                                                           min(fine.minHeight[c], fine.minHeight[d]));
+                coarse.maxHeight[y*coarse.width + x] = max(max(fine.maxHeight[a], fine.maxHeight[b]),
+                                                           max(fine.maxHeight[c], fine.maxHeight[d]));
+            }
+        }
+        levels.push_back(coarse);
+    }
+}
+
+size_t HeightPicker::memoryUsage() const
+{
+    size_t bytes = heights.size()*sizeof(float);
+    for (size_t i = 0; i < levels.size(); i++)
+        bytes += (levels[i].minHeight.size() + levels[i].maxHeight.size())*sizeof(float);
+    return bytes;
+}
+
+void HeightPicker::setGlobe(float radius, float heightScale, float spin)
+{
+    this->radius = radius;
+    this->heightScale = heightScale;
+    cosSpin = cos(spin);
+    sinSpin = sin(spin);
+}
+
+float HeightPicker::heightAt(float longitudeAngle, float colatitude) const
+{
+    // Texel centres sit half a texel in, edges clamp like GL_CLAMP_TO_EDGE
+    float fx = longitudeAngle/twoPi*mapWidth - 0.5f;
+    float fy = colatitude/(float) M_PI*mapHeight - 0.5f;
+    int x0 = (int) floor(fx), y0 = (int) floor(fy);
+    float tx = fx - x0, ty = fy - y0;
+
+    int xa = min(max(x0, 0), mapWidth - 1), xb = min(max(x0 + 1, 0), mapWidth - 1);
+    int ya = min(max(y0, 0), mapHeight - 1), yb = min(max(y0 + 1, 0), mapHeight - 1);
+
+    float top = heights[ya*mapWidth + xa] + tx*(heights[ya*mapWidth + xb] - heights[ya*mapWidth + xa]);
+    float bottom = heights[yb*mapWidth + xa] + tx*(heights[yb*mapWidth + xb] - heights[yb*mapWidth + xa]);
+    return top + ty*(bottom - top);
+}
+
+// Longitude angle in [0, 2pi) and colatitude in [0, pi], matching the
+// u = a/2pi, v = b/pi mapping of EclipseMap::createSphere
+static void sphericalAngles(const glm::vec3 &p, float &a, float &b)
+{
+    a = atan2(p.y, p.x);
+    if (a < 0)
+        a += twoPi;
+    float r = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+    b = acos(max(-1.0f, min(1.0f, r > 0 ? p.z/r : 1.0f)));
+}
+
+float HeightPicker::surfaceDistance(const glm::vec3 &p) const
+{
+    float a, b;
+    sphericalAngles(p, a, b);
+    return glm::length(p) - (radius + heightScale*heightAt(a, b));
+}
+
+PickResult HeightPicker::pick(const glm::vec3 &worldOrigin, const glm::vec3 &worldDirection) const
+{
+    PickResult result;
+    if (empty() || glm::length(worldDirection) == 0)
+        return result;
+
+    // Into globe space, undoing the spin about z. The camera is usually
+    // thousands of units out, so the shell is found in double and the march
+    // starts from where the ray enters it, keeping the float positions below
+    // accurate to a small fraction of a texel.
+    glm::vec3 direction = glm::normalize(worldDirection);
+    double ox = cosSpin*(double) worldOrigin.x + sinSpin*(double) worldOrigin.y;
+    double oy = -sinSpin*(double) worldOrigin.x + cosSpin*(double) worldOrigin.y;
+    double oz = worldOrigin.z;
+    glm::vec3 d(cosSpin*direction.x + sinSpin*direction.y, -sinSpin*direction.x + cosSpin*direction.y,
+                direction.z);
+
+    int topLevel = (int) levels.size() - 1;
+    float lowest = min(heightScale*levels[topLevel].minHeight[0], heightScale*levels[topLevel].maxHeight[0]);
+    float highest = max(heightScale*levels[topLevel].minHeight[0], heightScale*levels[topLevel].maxHeight[0]);
+
+    // Only the shell between the lowest and highest terrain can be hit
+    double b = ox*d.x + oy*d.y + oz*d.z;
+    double c = ox*ox + oy*oy + oz*oz;
+    float outer = radius + highest;
+    double discriminant = b*b - (c - (double) outer*outer);
+    if (discriminant < 0)
+        return result;
+    double entry = max(-b - sqrt(discriminant), 0.0);
+    float tEnd = -b + sqrt(discriminant) - entry;
+    if (tEnd < 0)
+        return result;
+
+    float inner = radius + lowest;
+    discriminant = b*b - (c - (double) inner*inner);
+    if (inner > 0 && discriminant >= 0 && -b - sqrt(discriminant) >= entry)
+        tEnd = -b - sqrt(discriminant) - entry;
+
+    // From here on distances are measured from the entry point
+    glm::vec3 o(ox + entry*d.x, oy + entry*d.y, oz + entry*d.z);
+    float closestApproach = -glm::dot(o, d);
+    float t = 0;
+
+    // Nudge used to look up the cell just past a boundary
+    float epsilon = 1e-5f*outer;
+
+    int level = topLevel;
+    float hit = -1;
+    while (t < tEnd) {
+        float a, colatitude;
+        sphericalAngles(o + (t + epsilon)*d, a, colatitude);
+        int tx = min(max((int) (a/twoPi*mapWidth), 0), mapWidth - 1);
+        int ty = min(max((int) (colatitude/(float) M_PI*mapHeight), 0), mapHeight - 1);
+        int cx = tx >> level, cy = ty >> level;
+
+        float tExit = min(cellExit(o, d, t + epsilon, level, cx, cy), tEnd);
+
+        // Lowest point of the segment against the highest terrain in the cell
+        const Level &cell = levels[level];
+        float cellTop = radius + max(heightScale*cell.minHeight[cy*cell.width + cx],
+                                     heightScale*cell.maxHeight[cy*cell.width + cx]);
+        float closest = min(max(closestApproach, t), tExit);
+        if (glm::length(o + closest*d) > cellTop) {
+            t = tExit;
+            level = min(level + 1, topLevel);
+            continue;
+        }
+
+        if (level > 0) {
+            level--;
+            continue;
+        }
+
+        if (refine(o, d, t, tExit, tx, ty, hit))
+            break;
+        t = tExit;
+        level = min(level + 1, topLevel);
+    }
+
+    if (hit < 0)
+        return result;
+
+    glm::vec3 p = o + hit*d;
+    float a, colatitude;
+    sphericalAngles(p, a, colatitude);
+
+    result.hit = true;
+    result.distance = entry + hit;
+    result.position = worldOrigin + result.distance*direction;
+    result.height = heightAt(a, colatitude);
+    result.elevation = heightScale*result.height;
+    result.latitude = 90 - glm::degrees(colatitude);
+    result.longitude = glm::degrees(a) - 180;
+    return result;
+}
+
+float HeightPicker::cellExit(const glm::vec3 &origin, const glm::vec3 &direction, float t, int level, int cx,
+                             int cy) const
+{
+    int x0 = cx << level, x1 = min((cx + 1) << level, mapWidth);
+    int y0 = cy << level, y1 = min((cy + 1) << level, mapHeight);
+    double exit = infinity;
+
+    // The origin can be thousands of units out, so the products below cancel
+    // badly in float; double keeps the crossings to well under a texel
+    double ox = origin.x, oy = origin.y, oz = origin.z;
+    double dx = direction.x, dy = direction.y, dz = direction.z;
+
+    // Longitude edges are half-planes through the z axis
+    if (x0 > 0 || x1 < mapWidth) {
+        int edges[2] = {x0, x1};
+        for (int i = 0; i < 2; i++) {
+            double angle = 2*M_PI*edges[i]/mapWidth;
+            double ca = cos(angle), sa = sin(angle);
+            double denominator = -sa*dx + ca*dy;
+            if (denominator == 0)
+                continue;
+            double crossing = (sa*ox - ca*oy)/denominator;
+            if (crossing > t && ca*(ox + crossing*dx) + sa*(oy + crossing*dy) >= 0)
+                exit = min(exit, crossing);
+        }
+    }
+
+    // Colatitude edges are cones around the z axis, or the equator plane
+    double oo = ox*ox + oy*oy + oz*oz;
+    double od = ox*dx + oy*dy + oz*dz;
+    double dd = dx*dx + dy*dy + dz*dz;
+    int edges[2] = {y0, y1};
+    for (int i = 0; i < 2; i++) {
+        if (edges[i] == 0 || edges[i] == mapHeight)
+            continue;
+        double cb = cos(M_PI*edges[i]/mapHeight);
+
+        if (fabs(cb) < 1e-9) {
+            if (dz != 0 && -oz/dz > t)
+                exit = min(exit, -oz/dz);
+            continue;
+        }
+
+        // z^2 = cos^2(b) |p|^2 on the side of the equator the cone opens to
+        double c2 = cb*cb;
+        double A = dz*dz - c2*dd;
+        double B = 2*(oz*dz - c2*od);
+        double C = oz*oz - c2*oo;
+        double roots[2];
+        int rootCount = 0;
+        if (fabs(A) < 1e-12) {
+            if (B != 0)
+                roots[rootCount++] = -C/B;
+        } else {
+            double discriminant = B*B - 4*A*C;
+            if (discriminant >= 0) {
+                // The stable form, the textbook one loses the small root to cancellation
+                double q = -0.5*(B + (B >= 0 ? 1 : -1)*sqrt(discriminant));
+                roots[rootCount++] = q/A;
+                if (q != 0)
+                    roots[rootCount++] = C/q;
+            }
+        }
+        for (int r = 0; r < rootCount; r++)
+            if (roots[r] > t && (oz + roots[r]*dz)*cb > 0)
+                exit = min(exit, roots[r]);
+    }
+
+    return (float) exit;
+}
+
+bool HeightPicker::refine(const glm::vec3 &o, const glm::vec3 &d, float t0, float t1, int tx, int ty,
+                          float &hit) const
+{
+    // Steps no longer than the surface distance over a bound on its slope
+    // along the ray can't pass over a crossing, so the first one found is
+    // the first there is. The bound is 1 for |p| plus the heightmap slope,
+    // from the texel neighbourhood's height range over the texel size, at
+    // the lowest radius and the colatitude nearest the pole in the texel.
+    const Level &base = levels[0];
+    float lo = base.minHeight[ty*mapWidth + tx], hi = base.maxHeight[ty*mapWidth + tx];
+    float innerRadius = max(radius + min(heightScale*lo, heightScale*hi), 0.5f*radius);
+    float texelAngle = (float) M_PI/mapHeight;
+    float sinNearPole = max(min(sin(ty*texelAngle), sin((ty + 1)*texelAngle)), sin(0.5f*texelAngle));
+    float slope = 1 + fabs(heightScale)*(hi - lo)*(mapWidth/twoPi/sinNearPole + mapHeight/(float) M_PI)/innerRadius;
+    float minStep = minRefineStep*texelAngle*radius;
+
+    // The first sample is just inside the texel: on the map's left and right
+    // edges the heights clamp instead of wrapping, so the surface steps at
+    // the seam and t0 itself may see the far side of it
+    float previousT = t0;
+    float t = min(t0 + minStep, t1);
+    while (true) {
+        float distance = surfaceDistance(o + t*d);
+        if (distance <= 0) {
+            float a = previousT, b = t;
+            for (int step = 0; step < refineSteps; step++) {
+                float mid = 0.5f*(a + b);
+                if (surfaceDistance(o + mid*d) > 0)
+                    a = mid;
+                else
+                    b = mid;
+            }
+            hit = b;
+            return true;
+        }
+        if (t >= t1)
+            return false;
+        previousT = t;
+        t = min(t + max(distance/slope, minStep), t1);
+    }
+}
+
+void HeightPicker::pickBatch(const glm::vec3 *origins, const glm::vec3 *directions, PickResult *results,
+                             int count) const
+{
+    int threads = thread::hardware_concurrency();
+    threads = min(max(threads, 1), max(count/minRaysPerThread, 1));
+
+    if (threads == 1) {
+        pickRange(origins, directions, results, 0, count);
+        return;
+    }
+
+    int chunk = (count + threads - 1)/threads;
+    vector<thread> workers;
+    for (int begin = 0; begin < count; begin += chunk)
+        workers.push_back(thread(&HeightPicker::pickRange, this, origins, directions, results, begin,
+                                 min(begin + chunk, count)));
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void HeightPicker::pickRange(const glm::vec3 *origins, const glm::vec3 *directions, PickResult *results,
+                             int begin, int end) const
+{
+    for (int i = begin; i < end; i++)
+        results[i] = pick(origins[i], directions[i]);
+}
+
+void HeightPicker::benchmark(int rayCount, ostream &out)
+{
+    // Smooth relief with sharp single texel peaks, which the pyramid has to
+    // descend to and refine() has to find
+    const int width = 2048, height = 1024;
+    vector<unsigned char> pixels(width*height);
+    srand(1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float value = 0.5f + 0.25f*sin(x*0.02f)*cos(y*0.03f) + 0.2f*sin(x*0.11f + y*0.07f) +
+                          0.1f*sin(x*0.9f + y*1.3f);
+            if (rand()%5000 == 0)
+                value = 1;
+            pixels[y*width + x] = (unsigned char) (max(0.0f, min(1.0f, value))*255);
+        }
+    }
+
+    HeightPicker picker;
+    picker.build(pixels.data(), width, height, 1);
+    picker.setGlobe(600, 80, 0.7f);
+
+    // From the start camera, from low over the surface and from inside the
+    // atmosphere, towards points around the globe; most of them hit
+    vector<glm::vec3> origins(rayCount), directions(rayCount);
+    const glm::vec3 cameras[3] = {glm::vec3(0, 4000, 4000), glm::vec3(700, 10, 20), glm::vec3(-300, -900, 400)};
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec3 target(1400.0f*rand()/RAND_MAX - 700, 1400.0f*rand()/RAND_MAX - 700, 1400.0f*rand()/RAND_MAX - 700);
+        origins[i] = cameras[i%3];
+        directions[i] = target - origins[i];
+    }
+
+    vector<PickResult> results(rayCount);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < rayCount; i++)
+        results[i] = picker.pick(origins[i], directions[i]);
+    double singleTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    picker.pickBatch(origins.data(), directions.data(), results.data(), rayCount);
+    double batchTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int hits = 0;
+    for (int i = 0; i < rayCount; i++)
+        hits += results[i].hit;
+
+    out << rayCount << " rays, " << hits << " hits: pick " << singleTime*1e6/rayCount << " us/ray, pickBatch "
+        << rayCount/batchTime << " rays/s" << endl;
+}
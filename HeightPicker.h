@@ -0,0 +1,87 @@
+#ifndef HEIGHTPICKER_H
+#define HEIGHTPICKER_H
+
+#include <vector>
+#include <iostream>
+#include "../glm/glm/glm.hpp"
+
+using namespace std;
+
+struct PickResult {
+    bool hit;
+    float distance;         // along the ray, world units
+    glm::vec3 position;     // world space
+    float latitude;         // degrees, north positive
+    float longitude;        // degrees, -180 at the left edge of the map
+    float elevation;        // above the undisplaced sphere, scene units
+    float height;           // heightmap value in [0, 1]
+
+    PickResult() : hit(false), distance(0), position(0), latitude(0), longitude(0), elevation(0), height(0) {}
+};
+
+// Ray queries against the displaced globe on the CPU, from the same grey
+// heightmap the world shader displaces with. A min/max pyramid over the map
+// lets a ray skip every latitude/longitude cell whose highest terrain it
+// passes above, so only a few texels near the hit are tested exactly. The
+// surface is the bilinear heightmap itself, so a pick can differ from the
+// drawn 250x125 mesh by the mesh's own tessellation error.
+// pick() and pickBatch() only read, so any number may run at once;
+// build() and setGlobe() must not run alongside them.
+class HeightPicker {
+public:
+    int minRaysPerThread = 256;
+
+    // pixels holds width*height texels of `components` bytes, the first one is used
+    void build(const unsigned char *pixels, int width, int height, int components);
+
+    // heightScale is the world displacement for a heightmap value of 1, spin
+    // the rotation of the globe about z in radians
+    void setGlobe(float radius, float heightScale, float spin);
+
+    bool empty() const { return levels.empty(); }
+
+    // Bytes held for the heightmap and its pyramid
+    size_t memoryUsage() const;
+
+    PickResult pick(const glm::vec3 &origin, const glm::vec3 &direction) const;
+
+    void pickBatch(const glm::vec3 *origins, const glm::vec3 *directions, PickResult *results, int count) const;
+
+    // Bilinear heightmap value at a direction from the globe centre, in globe space
+    float heightAt(float longitudeAngle, float colatitude) const;
+
+    // Times pick() and pickBatch() on rayCount rays into a synthetic 2048x1024 map
+    static void benchmark(int rayCount, ostream &out);
+
+private:
+    struct Level {
+        int width;
+        int height;
+        vector<float> minHeight;
+        vector<float> maxHeight;
+    };
+
+    int mapWidth = 0;
+    int mapHeight = 0;
+    vector<float> heights;
+    // levels[0] bounds the bilinear surface over each texel, each further
+    // level halves the resolution; the last is a single cell
+    vector<Level> levels;
+
+    float radius = 0;
+    float heightScale = 0;
+    float cosSpin = 1;
+    float sinSpin = 0;
+
+    void pickRange(const glm::vec3 *origins, const glm::vec3 *directions, PickResult *results, int begin, int end) const;
+
+    float cellExit(const glm::vec3 &origin, const glm::vec3 &direction, float t, int level, int cx, int cy) const;
+
+    // First crossing in [t0, t1], which lies in texel (tx, ty)
+    bool refine(const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, int tx, int ty,
+                float &hit) const;
+
+    float surfaceDistance(const glm::vec3 &p) const;
+};
+
+#endif
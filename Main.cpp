@@ -1,13 +1,100 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <stdio.h>
+#include <stdlib.h>
 #include "EclipseMap.h"
 using namespace std;
 
+static const char *defaultScenePath = "earth.scene";
+
+static void printUsage(const char *program)
+{
+    cout << "Usage: " << program << " [--vram-budget <MB>] <height map> <color texture> <moon texture> [scene file]"
+         << endl;
+    cout << "       " << program << " --bench-orbits <body count>" << endl;
+    cout << "       " << program << " --bench-scene <body count>" << endl;
+    cout << "       " << program << " --bench-picker <ray count>" << endl;
+    cout << "The scene file defaults to " << defaultScenePath << endl;
+    cout << "--vram-budget halves the least recently used textures while the estimated video memory is over" << endl;
+    cout << "<MB>, the height map excepted; without it there is no limit" << endl;
+}
+
+// A positive body or ray count or size, or -1
+static int parseCount(const char *text)
+{
+    char *end;
+    long count = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || count <= 0 || count > 100000000)
+        return -1;
+    return (int) count;
+}
+
+static bool isReadable(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fclose(file);
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
+    // hw3 --bench-orbits <body count>
+    // hw3 --bench-scene <body count>
+    // hw3 --bench-picker <ray count>
+    if (argc >= 2 && (string(argv[1]) == "--bench-orbits" || string(argv[1]) == "--bench-scene" ||
+                      string(argv[1]) == "--bench-picker")) {
+        int count = argc == 3 ? parseCount(argv[2]) : -1;
+        if (count < 0) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (string(argv[1]) == "--bench-orbits")
+            OrbitPropagator::benchmark(count, cout);
+        else if (string(argv[1]) == "--bench-scene")
+            SceneFile::benchmark(count, cout);
+        else
+            HeightPicker::benchmark(count, cout);
+        return 0;
+    }
+
+    // hw3 --vram-budget <MB> ..., the paths follow the option
+    const char *program = argv[0];
+    size_t vramBudget = 0;
+    if (argc >= 2 && string(argv[1]) == "--vram-budget") {
+        int megabytes = argc >= 3 ? parseCount(argv[2]) : -1;
+        if (megabytes < 0) {
+            printUsage(program);
+            return 1;
+        }
+        vramBudget = (size_t) megabytes*1024*1024;
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 4 || argc > 5) {
+        printUsage(program);
+        return 1;
+    }
+
+    // The scene may exist only in its compiled form
+    const char *scenePath = argc == 5 ? argv[4] : defaultScenePath;
+    string compiledScenePath = string(scenePath) + ".bin";
+    for (int i = 1; i < 4; i++) {
+        if (!isReadable(argv[i])) {
+            cout << "Cannot open " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (!isReadable(scenePath) && !isReadable(compiledScenePath.c_str())) {
+        cout << "Cannot open scene " << scenePath << endl;
+        return 1;
+    }
+
     EclipseMap *openGL = new EclipseMap();
-	openGL->Render(argv[2],argv[1],argv[3]);
-	
-}
\ No newline at end of file
+    openGL->setVramBudget(vramBudget);
+	openGL->Render(argv[2],argv[1],argv[3],scenePath);
+
+}
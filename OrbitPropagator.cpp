@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "OrbitPropagator.h"
+
+using namespace std;
+
+static const double twoPi = 2*M_PI;
+static const double maxEccentricity = 0.99;
+
+// sinf/cosf are library calls and keep the batch loops scalar. This is a
+// branch-free Cephes style polynomial (about 1e-7 absolute error for the
+// angles that show up here) that compiles to plain vector arithmetic.
+static inline void sinCos(float x, float &s, float &c)
+{
+    float y = x*(float) (2/M_PI);
+    int q = (int) (y + (y >= 0 ? 0.5f : -0.5f));
+
+    // x - q*pi/2 in three parts to keep the reduction exact
+    float r = x - q*1.5703125f;
+    r -= q*4.837512969970703125e-4f;
+    r -= q*7.54978995489188216e-8f;
+
+    float r2 = r*r;
+    float sr = r + r*r2*(-1.6666654611e-1f + r2*(8.3321608736e-3f + r2*-1.9515295891e-4f));
+    float cr = 1 - 0.5f*r2 + r2*r2*(4.166664568298827e-2f + r2*(-1.388731625493765e-3f + r2*2.443315711809948e-5f));
+
+    // Quadrant fix-up as arithmetic rather than selects
+    float swap = q & 1;
+    s = (sr + swap*(cr - sr))*(1 - (q & 2));
+    c = (cr + swap*(sr - cr))*(1 - ((q + 1) & 2));
+}
+
+int OrbitPropagator::addBody(const OrbitalBody &body)
+{
+    const KeplerElements &elements = body.elements;
+
+    double e = elements.eccentricity;
+    if (e < 0 || e > maxEccentricity) {
+        printf("Eccentricity %f is not an elliptic orbit, clamping\n", e);
+        e = e < 0 ? 0 : maxEccentricity;
+    }
+
+    double cO = cos(elements.ascendingNode), sO = sin(elements.ascendingNode);
+    double cw = cos(elements.argumentOfPeriapsis), sw = sin(elements.argumentOfPeriapsis);
+    double ci = cos(elements.inclination), si = sin(elements.inclination);
+
+    semiMajorAxis.push_back(elements.semiMajorAxis);
+    semiMinorAxis.push_back(elements.semiMajorAxis*sqrt(1 - e*e));
+    eccentricity.push_back(e);
+    meanAnomalyAtEpoch.push_back(elements.meanAnomalyAtEpoch);
+    meanMotion.push_back(elements.meanMotion);
+    epoch.push_back(elements.epoch);
+    spinAtEpoch.push_back(body.spinAtEpoch);
+    spinRate.push_back(body.spinRate);
+    scale.push_back(body.scale);
+
+    px.push_back(cO*cw - sO*sw*ci);
+    py.push_back(sO*cw + cO*sw*ci);
+    pz.push_back(sw*si);
+    qx.push_back(-cO*sw - sO*cw*ci);
+    qy.push_back(-sO*sw + cO*cw*ci);
+    qz.push_back(cw*si);
+
+    instanceTransforms.push_back(glm::mat4(1));
+
+    return size() - 1;
+}
+
+void OrbitPropagator::clear()
+{
+    semiMajorAxis.clear();
+    semiMinorAxis.clear();
+    eccentricity.clear();
+    meanAnomalyAtEpoch.clear();
+    meanMotion.clear();
+    epoch.clear();
+    spinAtEpoch.clear();
+    spinRate.clear();
+    scale.clear();
+    px.clear(); py.clear(); pz.clear();
+    qx.clear(); qy.clear(); qz.clear();
+    instanceTransforms.clear();
+}
+
+void OrbitPropagator::propagate(double time)
+{
+    int bodies = size();
+
+    int threads = thread::hardware_concurrency();
+    threads = min(max(threads, 1), max(bodies/minBodiesPerThread, 1));
+
+    if (threads == 1) {
+        propagateRange(time, 0, bodies);
+        return;
+    }
+
+    // Whole batches per thread so neighbouring threads do not share a batch
+    int chunk = (bodies + threads - 1)/threads;
+    chunk = (chunk + batchSize - 1)/batchSize*batchSize;
+
+    vector<thread> workers;
+    for (int begin = 0; begin < bodies; begin += chunk)
+        workers.push_back(thread(&OrbitPropagator::propagateRange, this, time, begin, min(begin + chunk, bodies)));
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void OrbitPropagator::propagateRange(double time, int begin, int end)
+{
+    // Every loop below runs over a whole batch so the compiler vectorises
+    // it; lanes past the end of the range solve a harmless circular orbit
+    float M[batchSize];
+    float E[batchSize];
+    float e[batchSize];
+    float spin[batchSize];
+    float sinE[batchSize], cosE[batchSize];
+    float sinSpin[batchSize], cosSpin[batchSize];
+
+    for (int i = begin; i < end; i += batchSize) {
+        int count = min(batchSize, end - i);
+
+        // Mean anomaly and spin at the requested time, directly from the epoch;
+        // done in double so far-off dates keep their precision
+        for (int k = 0; k < batchSize; k++) {
+            M[k] = 0;
+            e[k] = 0;
+            spin[k] = 0;
+        }
+        for (int k = 0; k < count; k++) {
+            double dt = time - epoch[i+k];
+            double m = meanAnomalyAtEpoch[i+k] + meanMotion[i+k]*dt;
+            M[k] = (float) (m - twoPi*floor(m/twoPi + 0.5));
+            double s = spinAtEpoch[i+k] + spinRate[i+k]*dt;
+            spin[k] = (float) (s - twoPi*floor(s/twoPi));
+            e[k] = eccentricity[i+k];
+        }
+
+        // Kepler's equation M = E - e sin E. Danby's starter converges for
+        // every elliptic eccentricity, and a fixed number of Halley steps
+        // keeps every lane doing the same work
+        for (int k = 0; k < batchSize; k++)
+            E[k] = M[k] + copysignf(0.85f*e[k], M[k]);
+        for (int iteration = 0; iteration < solverIterations; iteration++) {
+            for (int k = 0; k < batchSize; k++) {
+                float s, c;
+                sinCos(E[k], s, c);
+                // Halley step, f = E - e sin E - M
+                float f = E[k] - e[k]*s - M[k];
+                float df = 1 - e[k]*c;
+                E[k] -= f/(df - 0.5f*f*e[k]*s/df);
+            }
+        }
+
+        for (int k = 0; k < batchSize; k++) {
+            sinCos(E[k], sinE[k], cosE[k]);
+            sinCos(spin[k], sinSpin[k], cosSpin[k]);
+        }
+
+        for (int k = 0; k < count; k++) {
+            int b = i + k;
+            float x = semiMajorAxis[b]*(cosE[k] - e[k]);
+            float y = semiMinorAxis[b]*sinE[k];
+            float c = cosSpin[k]*scale[b];
+            float s = sinSpin[k]*scale[b];
+
+            glm::mat4 &m = instanceTransforms[b];
+            m[0] = glm::vec4(c, s, 0, 0);
+            m[1] = glm::vec4(-s, c, 0, 0);
+            m[2] = glm::vec4(0, 0, scale[b], 0);
+            m[3] = glm::vec4(x*px[b] + y*qx[b], x*py[b] + y*qy[b], x*pz[b] + y*qz[b], 1);
+        }
+    }
+}
+
+glm::vec3 OrbitPropagator::position(int body) const
+{
+    const glm::vec4 &p = instanceTransforms[body][3];
+    return glm::vec3(p.x, p.y, p.z);
+}
+
+double OrbitPropagator::period(int body) const
+{
+    return meanMotion[body] != 0 ? twoPi/fabs(meanMotion[body]) : 0;
+}
+
+void OrbitPropagator::benchmark(int bodyCount, ostream &out)
+{
+    OrbitPropagator propagator;
+
+    srand(1);
+    for (int i = 0; i < bodyCount; i++) {
+        OrbitalBody body;
+        body.elements.semiMajorAxis = 1000 + 9000.0*rand()/RAND_MAX;
+        body.elements.eccentricity = 0.95*rand()/RAND_MAX;
+        body.elements.inclination = M_PI*rand()/RAND_MAX;
+        body.elements.ascendingNode = twoPi*rand()/RAND_MAX;
+        body.elements.argumentOfPeriapsis = twoPi*rand()/RAND_MAX;
+        body.elements.meanAnomalyAtEpoch = twoPi*rand()/RAND_MAX;
+        body.elements.meanMotion = twoPi/(100 + 10000.0*rand()/RAND_MAX);
+        body.spinRate = 0.1*rand()/RAND_MAX;
+        propagator.addBody(body);
+    }
+
+    // Warm up, this also faults in the transform array
+    propagator.propagate(0);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double elapsed = 0;
+    long long steps = 0;
+    while (elapsed < 1 || steps < 3) {
+        // Arbitrary dates, each one a time-warp jump
+        propagator.propagate(steps*86400.0*365.25);
+        steps++;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    double propagated = (double) bodyCount*steps;
+    out << bodyCount << " bodies, " << steps << " propagations in " << elapsed << " s: "
+        << propagated/elapsed << " bodies/s, " << elapsed*1e9/propagated << " ns/body" << endl;
+}
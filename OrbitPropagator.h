@@ -0,0 +1,81 @@
+#ifndef ORBITPROPAGATOR_H
+#define ORBITPROPAGATOR_H
+
+#include <vector>
+#include <iostream>
+#include "../glm/glm/glm.hpp"
+
+using namespace std;
+
+// Classical orbital elements, angles in radians and time in simulation seconds
+struct KeplerElements {
+    double semiMajorAxis;
+    double eccentricity;
+    double inclination;
+    double ascendingNode;
+    double argumentOfPeriapsis;
+    double meanAnomalyAtEpoch;
+    double meanMotion;          // radians per second
+    double epoch;
+
+    KeplerElements() : semiMajorAxis(0), eccentricity(0), inclination(0), ascendingNode(0), argumentOfPeriapsis(0),
+                       meanAnomalyAtEpoch(0), meanMotion(0), epoch(0) {}
+};
+
+struct OrbitalBody {
+    KeplerElements elements;
+    double spinAtEpoch;         // rotation about the z axis, radians
+    double spinRate;            // radians per second
+    float scale;
+
+    OrbitalBody() : spinAtEpoch(0), spinRate(0), scale(1) {}
+};
+
+// Propagates bodies on fixed Kepler orbits around the origin. Positions are
+// closed form in time, so jumping to any date costs the same as a single
+// step. Bodies are stored as structure of arrays and solved in fixed size
+// batches the compiler can vectorise; large sets are split across threads.
+class OrbitPropagator {
+public:
+    static const int batchSize = 8;
+    static const int solverIterations = 4;
+    int minBodiesPerThread = 4096;
+
+    int addBody(const OrbitalBody &body);
+
+    void clear();
+
+    int size() const { return (int) semiMajorAxis.size(); }
+
+    // Writes one model matrix per body into transforms()
+    void propagate(double time);
+
+    const vector<glm::mat4> &transforms() const { return instanceTransforms; }
+
+    glm::vec3 position(int body) const;
+
+    double period(int body) const;
+
+    static void benchmark(int bodyCount, ostream &out);
+
+private:
+    // Per body constants, precomputed in addBody
+    vector<float> semiMajorAxis;
+    vector<float> semiMinorAxis;
+    vector<float> eccentricity;
+    vector<double> meanAnomalyAtEpoch;
+    vector<double> meanMotion;
+    vector<double> epoch;
+    vector<double> spinAtEpoch;
+    vector<double> spinRate;
+    vector<float> scale;
+    // Perifocal frame: P points to periapsis, Q is 90 degrees ahead in the orbit plane
+    vector<float> px, py, pz;
+    vector<float> qx, qy, qz;
+
+    vector<glm::mat4> instanceTransforms;
+
+    void propagateRange(double time, int begin, int end);
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include <cmath>
+#include "ResolutionController.h"
+
+using namespace std;
+
+// Fraction of the newest sample blended into the running frame time
+static const float smoothing = 0.1;
+// Frames to wait after a change before the scale may change again
+static const int settleFrames = 16;
+// Relative deviation from the budget that is tolerated without rescaling
+static const float deadband = 0.1;
+
+void ResolutionController::init()
+{
+    glGenQueries(queryCount, queries);
+    for (int i = 0; i < queryCount; i++)
+        pending[i] = false;
+}
+
+void ResolutionController::beginFrame()
+{
+    // All queries still in flight, skip measuring this frame
+    if (pending[currentQuery]) {
+        measuring = false;
+        return;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[currentQuery]);
+    measuring = true;
+}
+
+void ResolutionController::endFrame()
+{
+    if (!measuring)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[currentQuery] = true;
+    currentQuery = (currentQuery + 1) % queryCount;
+    measuring = false;
+}
+
+void ResolutionController::update()
+{
+    framesSinceChange++;
+
+    // Oldest query first; stop at the first one the GPU has not finished
+    for (int i = 0; i < queryCount; i++) {
+        int q = (currentQuery + i) % queryCount;
+        if (!pending[q])
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &elapsed);
+        pending[q] = false;
+
+        // Still timed at the previous scale
+        if (framesSinceChange <= queryCount)
+            continue;
+
+        float ms = elapsed/1000000.0f;
+        if (smoothedFrameTime == 0)
+            smoothedFrameTime = ms;
+        else
+            smoothedFrameTime += (ms - smoothedFrameTime)*smoothing;
+    }
+
+    if (smoothedFrameTime == 0 || framesSinceChange < settleFrames)
+        return;
+
+    float ratio = targetFrameTime/smoothedFrameTime;
+    if (fabs(ratio - 1) < deadband)
+        return;
+
+    // Fill cost goes with the pixel count, i.e. the square of the scale
+    float newScale = currentScale*sqrt(ratio);
+    if (newScale < minScale)
+        newScale = minScale;
+    if (newScale > maxScale)
+        newScale = maxScale;
+
+    if (newScale != currentScale) {
+        currentScale = newScale;
+        smoothedFrameTime = 0;
+        framesSinceChange = 0;
+    }
+}
+
+void ResolutionController::reset()
+{
+    currentScale = maxScale;
+    smoothedFrameTime = 0;
+    framesSinceChange = 0;
+}
+
+void ResolutionController::destroy()
+{
+    glDeleteQueries(queryCount, queries);
+}
@@ -0,0 +1,46 @@
+#ifndef RESOLUTIONCONTROLLER_H
+#define RESOLUTIONCONTROLLER_H
+
+#include <GL/glew.h>
+
+using namespace std;
+
+// Picks the scene render scale from measured GPU frame time. Frame time is
+// read back from GL_TIME_ELAPSED queries a few frames late so the CPU never
+// waits on the GPU.
+class ResolutionController {
+public:
+    float targetFrameTime = 1000.0/60; // ms
+    float minScale = 0.5;
+    float maxScale = 1.0;
+
+    void init();
+
+    void beginFrame();
+
+    void endFrame();
+
+    // Reads finished queries and adjusts the scale, call once per frame
+    void update();
+
+    void reset();
+
+    float scale() const { return currentScale; }
+
+    float frameTime() const { return smoothedFrameTime; }
+
+    void destroy();
+
+private:
+    static const int queryCount = 4;
+    GLuint queries[queryCount];
+    bool pending[queryCount];
+    int currentQuery = 0;
+    bool measuring = false;
+
+    float currentScale = 1;
+    float smoothedFrameTime = 0;
+    int framesSinceChange = 0;
+};
+
+#endif
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <algorithm>
+#include "ResourceManager.h"
+
+using namespace std;
+
+// Unit used to bind textures while they are being resized
+static const int scratchTextureUnit = 15;
+
+ResourceHandle::ResourceHandle(ResourceHandle &&other) : manager(other.manager), index(other.index),
+                                                           generation(other.generation)
+{
+    other.manager = NULL;
+    other.index = -1;
+}
+
+ResourceHandle &ResourceHandle::operator=(ResourceHandle &&other)
+{
+    if (this != &other) {
+        reset();
+        manager = other.manager;
+        index = other.index;
+        generation = other.generation;
+        other.manager = NULL;
+        other.index = -1;
+    }
+    return *this;
+}
+
+void ResourceHandle::reset()
+{
+    if (manager)
+        manager->release(index, generation);
+    manager = NULL;
+    index = -1;
+}
+
+GLuint ResourceHandle::name() const
+{
+    if (!manager || !manager->resources[index].alive || manager->resources[index].generation != generation)
+        return 0;
+    return manager->resources[index].name;
+}
+
+void ResourceManager::init(GLState *state)
+{
+    this->state = state;
+}
+
+ResourceHandle ResourceManager::add(const string &label, int type, GLuint name)
+{
+    Resource resource;
+    resource.label = label;
+    resource.type = type;
+    resource.name = name;
+    resource.alive = true;
+    resource.evictable = false;
+    resource.bytes = 0;
+    resource.target = 0;
+    resource.internalFormat = 0;
+    resource.width = resource.height = resource.depth = 0;
+    resource.samples = 0;
+    resource.mipmapped = false;
+    resource.downsampled = 0;
+    resource.lastUsed = frame;
+
+    // Released slots are reused, e.g. by every SceneTarget resize; the
+    // generation tells a stale handle it no longer owns the slot
+    int index;
+    if (freeSlots.empty()) {
+        resource.generation = 0;
+        index = (int) resources.size();
+        resources.push_back(resource);
+    } else {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+        resource.generation = resources[index].generation + 1;
+        resources[index] = resource;
+    }
+    return ResourceHandle(this, index, resource.generation);
+}
+
+ResourceHandle ResourceManager::createTexture(const string &label, bool evictable)
+{
+    GLuint name;
+    glGenTextures(1, &name);
+    ResourceHandle handle = add(label, textureResource, name);
+    resources[handle.id()].evictable = evictable;
+    return handle;
+}
+
+ResourceHandle ResourceManager::createBuffer(const string &label)
+{
+    GLuint name;
+    glGenBuffers(1, &name);
+    return add(label, bufferResource, name);
+}
+
+ResourceHandle ResourceManager::createRenderbuffer(const string &label)
+{
+    GLuint name;
+    glGenRenderbuffers(1, &name);
+    return add(label, renderbufferResource, name);
+}
+
+ResourceHandle ResourceManager::createVertexArray(const string &label)
+{
+    GLuint name;
+    glGenVertexArrays(1, &name);
+    return add(label, vertexArrayResource, name);
+}
+
+ResourceHandle ResourceManager::adoptProgram(const string &label, GLuint program)
+{
+    return add(label, programResource, program);
+}
+
+ResourceHandle ResourceManager::createFramebuffer(const string &label)
+{
+    GLuint name;
+    glGenFramebuffers(1, &name);
+    return add(label, framebufferResource, name);
+}
+
+void ResourceManager::textureStorage(const ResourceHandle &texture, GLenum target, GLenum internalFormat, int width,
+                                     int height, int depth, bool mipmapped)
+{
+    recordTexture(resources[texture.id()], target, internalFormat, width, height, depth, mipmapped);
+}
+
+void ResourceManager::recordTexture(Resource &resource, GLenum target, GLenum internalFormat, int width, int height,
+                                    int depth, bool mipmapped)
+{
+    resource.target = target;
+    resource.internalFormat = internalFormat;
+    resource.width = width;
+    resource.height = height;
+    resource.depth = depth;
+    resource.mipmapped = mipmapped;
+
+    // A full mip chain adds a third
+    size_t base = (size_t) width*height*depth*bytesPerTexel(internalFormat);
+    resource.bytes = mipmapped ? base*4/3 : base;
+
+    // Only 8 bit 2D textures can be read back and shrunk
+    if (target != GL_TEXTURE_2D || bytesPerTexel(internalFormat) > 4)
+        resource.evictable = false;
+}
+
+void ResourceManager::bufferData(const ResourceHandle &buffer, GLenum target, GLsizeiptr size, const void *data,
+                                 GLenum usage)
+{
+    Resource &resource = resources[buffer.id()];
+    glBindBuffer(target, resource.name);
+    glBufferData(target, size, data, usage);
+    resource.target = target;
+    resource.bytes = size;
+}
+
+void ResourceManager::renderbufferStorage(const ResourceHandle &renderbuffer, GLenum internalFormat, int samples,
+                                          int width, int height)
+{
+    Resource &resource = resources[renderbuffer.id()];
+    glBindRenderbuffer(GL_RENDERBUFFER, resource.name);
+    if (samples > 0)
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, internalFormat, width, height);
+    else
+        glRenderbufferStorage(GL_RENDERBUFFER, internalFormat, width, height);
+
+    resource.target = GL_RENDERBUFFER;
+    resource.internalFormat = internalFormat;
+    resource.width = width;
+    resource.height = height;
+    resource.depth = 1;
+    resource.samples = samples;
+    resource.bytes = (size_t) width*height*max(samples, 1)*bytesPerTexel(internalFormat);
+}
+
+void ResourceManager::bindTexture(int unit, const ResourceHandle &texture)
+{
+    Resource &resource = resources[texture.id()];
+    state->bindTexture(unit, resource.target ? resource.target : GL_TEXTURE_2D, resource.name);
+    resource.lastUsed = frame;
+}
+
+void ResourceManager::bindTextureForEdit(int unit, const ResourceHandle &texture)
+{
+    Resource &resource = resources[texture.id()];
+    state->bindTextureForEdit(unit, resource.target ? resource.target : GL_TEXTURE_2D, resource.name);
+}
+
+void ResourceManager::setHostMemory(const string &label, size_t bytes)
+{
+    if (bytes == 0)
+        hostMemory.erase(label);
+    else
+        hostMemory[label] = bytes;
+}
+
+void ResourceManager::enforceBudget()
+{
+    if (vramBudget == 0)
+        return;
+
+    size_t total = deviceBytes();
+    while (total > vramBudget) {
+        // Least recently used first, the biggest of those first
+        Resource *victim = NULL;
+        for (size_t i = 0; i < resources.size(); i++) {
+            Resource &resource = resources[i];
+            if (!resource.alive || !resource.evictable || resource.type != textureResource)
+                continue;
+            if (resource.width/2 < minTextureSize || resource.height/2 < minTextureSize)
+                continue;
+            if (!victim || resource.lastUsed < victim->lastUsed ||
+                (resource.lastUsed == victim->lastUsed && resource.bytes > victim->bytes))
+                victim = &resource;
+        }
+
+        if (!victim) {
+            if (!overBudgetReported)
+                printf("Over the VRAM budget by %.1f MB with nothing left to shrink\n",
+                       (total - vramBudget)/(1024.0*1024.0));
+            overBudgetReported = true;
+            return;
+        }
+
+        size_t before = victim->bytes;
+        if (!downsample(*victim))
+            victim->evictable = false;
+        else
+            printf("Over the VRAM budget, %s shrunk to %dx%d\n", victim->label.c_str(), victim->width,
+                   victim->height);
+        total = total - before + victim->bytes;
+    }
+    overBudgetReported = false;
+}
+
+bool ResourceManager::downsample(Resource &texture)
+{
+    int width = texture.width, height = texture.height;
+    int halfWidth = max(width/2, 1), halfHeight = max(height/2, 1);
+
+    // The texture may already sit on the scratch unit while another unit is
+    // active, so the unit is made active whatever the cache says
+    state->bindTextureForEdit(scratchTextureUnit, GL_TEXTURE_2D, texture.name);
+
+    // Read back as RGBA bytes whatever the format, rows stay 4 byte aligned
+    while (glGetError() != GL_NO_ERROR)
+        ;
+    vector<unsigned char> pixels((size_t) width*height*4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    if (glGetError() != GL_NO_ERROR)
+        return false;
+
+    // 2x2 box filter, the last row or column repeats on odd sizes
+    vector<unsigned char> half((size_t) halfWidth*halfHeight*4);
+    for (int y = 0; y < halfHeight; y++) {
+        int y0 = min(2*y, height - 1), y1 = min(2*y + 1, height - 1);
+        for (int x = 0; x < halfWidth; x++) {
+            int x0 = min(2*x, width - 1), x1 = min(2*x + 1, width - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = pixels[(y0*width + x0)*4 + c] + pixels[(y0*width + x1)*4 + c] +
+                          pixels[(y1*width + x0)*4 + c] + pixels[(y1*width + x1)*4 + c];
+                half[(y*halfWidth + x)*4 + c] = (unsigned char) ((sum + 2)/4);
+            }
+        }
+    }
+
+    glTexImage2D(GL_TEXTURE_2D, 0, texture.internalFormat, halfWidth, halfHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 half.data());
+    if (texture.mipmapped)
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+    texture.downsampled++;
+    recordTexture(texture, GL_TEXTURE_2D, texture.internalFormat, halfWidth, halfHeight, 1, texture.mipmapped);
+    return true;
+}
+
+size_t ResourceManager::deviceBytes() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < resources.size(); i++)
+        if (resources[i].alive)
+            total += resources[i].bytes;
+    return total;
+}
+
+size_t ResourceManager::hostBytes() const
+{
+    size_t total = 0;
+    for (map<string, size_t>::const_iterator it = hostMemory.begin(); it != hostMemory.end(); ++it)
+        total += it->second;
+    return total;
+}
+
+void ResourceManager::printReport(ostream &out) const
+{
+    const double MB = 1024.0*1024.0;
+
+    int counts[typeCount] = {};
+    size_t bytes[typeCount] = {};
+    vector<const Resource *> live;
+    for (size_t i = 0; i < resources.size(); i++) {
+        if (!resources[i].alive)
+            continue;
+        counts[resources[i].type]++;
+        bytes[resources[i].type] += resources[i].bytes;
+        live.push_back(&resources[i]);
+    }
+
+    out << "GPU memory (estimated): " << deviceBytes()/MB << " MB";
+    if (vramBudget > 0)
+        out << " of " << vramBudget/MB << " MB budget";
+    out << endl;
+    for (int type = 0; type < typeCount; type++)
+        if (counts[type] > 0)
+            out << "  " << counts[type] << " " << typeName(type) << ", " << bytes[type]/MB << " MB" << endl;
+
+    sort(live.begin(), live.end(), [](const Resource *a, const Resource *b) { return a->bytes > b->bytes; });
+    for (size_t i = 0; i < live.size(); i++) {
+        const Resource &resource = *live[i];
+        if (resource.bytes == 0)
+            continue;
+        out << "    " << resource.label << ": " << resource.bytes/MB << " MB";
+        if (resource.width > 0) {
+            out << ", " << resource.width << "x" << resource.height;
+            if (resource.depth > 1)
+                out << "x" << resource.depth;
+        }
+        if (resource.samples > 0)
+            out << ", " << resource.samples << " samples";
+        if (resource.downsampled > 0)
+            out << ", halved " << resource.downsampled << "x";
+        if (resource.type == textureResource)
+            out << ", used " << frame - resource.lastUsed << " frames ago";
+        out << endl;
+    }
+
+    out << "Host memory: " << hostBytes()/MB << " MB" << endl;
+    for (map<string, size_t>::const_iterator it = hostMemory.begin(); it != hostMemory.end(); ++it)
+        out << "    " << it->first << ": " << it->second/MB << " MB" << endl;
+}
+
+void ResourceManager::releaseAll()
+{
+    for (size_t i = 0; i < resources.size(); i++)
+        release(i, resources[i].generation);
+    hostMemory.clear();
+}
+
+void ResourceManager::release(int index, unsigned int generation)
+{
+    if (index < 0 || index >= (int) resources.size() || !resources[index].alive ||
+        resources[index].generation != generation)
+        return;
+
+    Resource &resource = resources[index];
+    switch (resource.type) {
+        case textureResource:
+            state->forgetTexture(resource.name);
+            glDeleteTextures(1, &resource.name);
+            break;
+        case bufferResource:
+            glDeleteBuffers(1, &resource.name);
+            break;
+        case renderbufferResource:
+            glDeleteRenderbuffers(1, &resource.name);
+            break;
+        case vertexArrayResource:
+            state->forgetVertexArray(resource.name);
+            glDeleteVertexArrays(1, &resource.name);
+            break;
+        case programResource:
+            state->forgetProgram(resource.name);
+            glDeleteProgram(resource.name);
+            break;
+        case framebufferResource:
+            state->forgetFramebuffer(resource.name);
+            glDeleteFramebuffers(1, &resource.name);
+            break;
+    }
+
+    resource.alive = false;
+    resource.bytes = 0;
+    freeSlots.push_back(index);
+}
+
+size_t ResourceManager::bytesPerTexel(GLenum internalFormat)
+{
+    switch (internalFormat) {
+        case GL_RED:
+        case GL_R8:
+            return 1;
+        // Drivers pad 3 channel 8 bit formats to 4
+        case GL_RGB:
+        case GL_RGB8:
+        case GL_RGBA:
+        case GL_RGBA8:
+        case GL_DEPTH24_STENCIL8:
+        case GL_DEPTH_COMPONENT24:
+            return 4;
+        case GL_RGB16F:
+            return 6;
+        case GL_RGBA16F:
+            return 8;
+        case GL_RGB32F:
+            return 12;
+        case GL_RGBA32F:
+            return 16;
+    }
+    return 4;
+}
+
+const char *ResourceManager::typeName(int type)
+{
+    switch (type) {
+        case textureResource: return "textures";
+        case bufferResource: return "buffers";
+        case renderbufferResource: return "renderbuffers";
+        case vertexArrayResource: return "vertex arrays";
+        case programResource: return "programs";
+        case framebufferResource: return "framebuffers";
+    }
+    return "unknown";
+}
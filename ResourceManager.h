@@ -0,0 +1,153 @@
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <GL/glew.h>
+#include "GLState.h"
+
+using namespace std;
+
+class ResourceManager;
+
+// Owns one GL object created through ResourceManager and deletes it, with
+// the right glDelete* call, when it goes out of scope or is reset. Handles
+// can be moved but not copied.
+class ResourceHandle {
+public:
+    ResourceHandle() : manager(NULL), index(-1), generation(0) {}
+
+    ResourceHandle(ResourceManager *manager, int index, unsigned int generation) : manager(manager), index(index),
+                                                                                  generation(generation) {}
+
+    ResourceHandle(ResourceHandle &&other);
+
+    ResourceHandle &operator=(ResourceHandle &&other);
+
+    ResourceHandle(const ResourceHandle &) = delete;
+
+    ResourceHandle &operator=(const ResourceHandle &) = delete;
+
+    ~ResourceHandle() { reset(); }
+
+    void reset();
+
+    // 0 once released, like an unset GL name
+    GLuint name() const;
+
+    int id() const { return index; }
+
+private:
+    ResourceManager *manager;
+    int index;
+    unsigned int generation; // of the record slot, which is reused once released
+};
+
+// Creates, tracks and deletes the GL objects of the renderer. Every texture,
+// buffer and renderbuffer is recorded with its estimated size, so the memory
+// report shows where video memory goes. Textures bound through bindTexture()
+// remember the frame they were last used in; when the total goes over
+// vramBudget the least recently used evictable textures are halved in size,
+// on the GPU side only, until the scene fits or nothing is left to shrink.
+// Host memory that mirrors GPU data can be registered for the report too.
+class ResourceManager {
+public:
+    enum resourceTypes {
+        textureResource, bufferResource, renderbufferResource, vertexArrayResource, programResource,
+        framebufferResource,
+        typeCount
+    };
+
+    size_t vramBudget = 0; // bytes, 0 for no limit
+    int minTextureSize = 256; // neither side of a texture is shrunk below this
+
+    void init(GLState *state);
+
+    ResourceHandle createTexture(const string &label, bool evictable);
+
+    ResourceHandle createBuffer(const string &label);
+
+    ResourceHandle createRenderbuffer(const string &label);
+
+    ResourceHandle createVertexArray(const string &label);
+
+    // Takes ownership of a linked program, e.g. from initShaders
+    ResourceHandle adoptProgram(const string &label, GLuint program);
+
+    ResourceHandle createFramebuffer(const string &label);
+
+    // Records the storage of the texture bound with bindTexture(); depth is 1 for 2D
+    void textureStorage(const ResourceHandle &texture, GLenum target, GLenum internalFormat, int width, int height,
+                        int depth, bool mipmapped);
+
+    // glBufferData through the manager, so the size is known
+    void bufferData(const ResourceHandle &buffer, GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+
+    void renderbufferStorage(const ResourceHandle &renderbuffer, GLenum internalFormat, int samples, int width,
+                             int height);
+
+    void bindTexture(int unit, const ResourceHandle &texture);
+
+    // Binds for glTex* calls on the texture, with the unit left active; not counted as a use
+    void bindTextureForEdit(int unit, const ResourceHandle &texture);
+
+    void setHostMemory(const string &label, size_t bytes);
+
+    void beginFrame() { frame++; }
+
+    // Shrinks textures until the budget is met, call once per frame
+    void enforceBudget();
+
+    size_t deviceBytes() const;
+
+    size_t hostBytes() const;
+
+    void printReport(ostream &out) const;
+
+    // Deletes everything still alive; handles released afterwards do nothing
+    void releaseAll();
+
+private:
+    friend class ResourceHandle;
+
+    struct Resource {
+        string label;
+        int type;
+        GLuint name;
+        bool alive;
+        bool evictable;
+        size_t bytes;
+        GLenum target;
+        GLenum internalFormat;
+        int width, height, depth;
+        int samples;
+        bool mipmapped;
+        int downsampled;
+        unsigned int lastUsed;
+        unsigned int generation;
+    };
+
+    GLState *state = NULL;
+    vector<Resource> resources;
+    vector<int> freeSlots; // released records, reused before the list grows
+    map<string, size_t> hostMemory;
+    unsigned int frame = 0;
+    bool overBudgetReported = false;
+
+    ResourceHandle add(const string &label, int type, GLuint name);
+
+    void release(int index, unsigned int generation);
+
+    void recordTexture(Resource &resource, GLenum target, GLenum internalFormat, int width, int height, int depth,
+                       bool mipmapped);
+
+    bool downsample(Resource &texture);
+
+    static size_t bytesPerTexel(GLenum internalFormat);
+
+    static const char *typeName(int type);
+};
+
+#endif
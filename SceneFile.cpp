@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SceneFile.h"
+
+using namespace std;
+
+static const char sceneMagic[8] = "HW3SCNE";
+static const int sceneVersion = 2;
+// Sections start on this boundary so the mapped arrays are aligned
+static const long long sectionAlignment = 16;
+static const int floatsPerVertex = 8;
+
+struct MeshSection {
+    long long vertexOffset;
+    long long vertexCount;
+    long long indexOffset;
+    long long indexCount;
+    long long maxIndex;         // -1 without indices
+};
+
+// One orbiting body, radians and seconds
+struct BodyRecord {
+    double semiMajorAxis;
+    double eccentricity;
+    double inclination;
+    double ascendingNode;
+    double argumentOfPeriapsis;
+    double meanAnomalyAtEpoch;
+    double meanMotion;
+    double epoch;
+    double spinAtEpoch;
+    double spinRate;
+    double scale;
+};
+
+struct SceneHeader {
+    char magic[8];
+    int version;
+    int bodyCount;
+    // Size and modification time of the text the file was compiled from
+    long long sourceSize;
+    long long sourceTime;
+    long long fileSize;
+    long long bodyOffset;
+    MeshSection meshes[SceneFile::meshCount];
+    SceneSettings settings;
+};
+
+static long long alignSection(long long offset)
+{
+    return (offset + sectionAlignment - 1)/sectionAlignment*sectionAlignment;
+}
+
+// Whether count elements at offset lie inside the file after the header;
+// divides rather than multiplies, so no count can overflow
+static bool sectionFits(long long offset, long long count, long long elementSize, long long fileSize)
+{
+    return offset >= (long long) sizeof(SceneHeader) && offset <= fileSize && offset%sectionAlignment == 0 &&
+           count >= 0 && count <= (fileSize - offset)/elementSize;
+}
+
+static bool sourceStamp(const char *path, long long &size, long long &time)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+    size = st.st_size;
+    time = st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// Latitude/longitude sphere around the origin; u follows the longitude and v
+// the colatitude, the layout the textures and the height picker expect
+static void generateSphere(float radius, int horizontalSplitCount, int verticalSplitCount, vector<float> &vertices,
+                           vector<int> &indices)
+{
+    for (int i = 0; i <= verticalSplitCount; i++) {
+        float b = M_PI*i/verticalSplitCount;
+
+        for (int j = 0; j <= horizontalSplitCount; j++) {
+            float a = 2*M_PI*j/horizontalSplitCount;
+
+            float x = radius*sin(b)*cos(a);
+            float y = radius*sin(b)*sin(a);
+            float z = radius*cos(b);
+
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+
+            glm::vec3 n = glm::normalize(glm::vec3(x, y, z));
+            vertices.push_back(n.x);
+            vertices.push_back(n.y);
+            vertices.push_back(n.z);
+
+            vertices.push_back(((float) j)/horizontalSplitCount);
+            vertices.push_back(((float) i)/verticalSplitCount);
+        }
+    }
+
+    for (int i = 0; i < verticalSplitCount; i++) {
+        int k1 = i*(horizontalSplitCount + 1);
+        int k2 = k1 + horizontalSplitCount + 1;
+
+        for (int j = 0; j < horizontalSplitCount; j++, k1++, k2++) {
+            if (i != 0) {
+                indices.push_back(k1);
+                indices.push_back(k2);
+                indices.push_back(k1 + 1);
+            }
+
+            if (i != (verticalSplitCount - 1)) {
+                indices.push_back(k1 + 1);
+                indices.push_back(k2);
+                indices.push_back(k2 + 1);
+            }
+        }
+    }
+}
+
+static bool readVector(istringstream &values, glm::vec3 &v)
+{
+    return (bool) (values >> v.x >> v.y >> v.z);
+}
+
+static bool parseScene(const char *textPath, SceneSettings &settings, vector<BodyRecord> &bodies)
+{
+    ifstream file(textPath);
+    if (!file.is_open()) {
+        printf("Cannot open scene file %s\n", textPath);
+        return false;
+    }
+
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != string::npos)
+            line.erase(comment);
+
+        istringstream values(line);
+        string key;
+        if (!(values >> key))
+            continue;
+
+        BodyRecord *body = bodies.empty() ? NULL : &bodies.back();
+        double value = 0;
+        bool valid = true;
+        if (key == "body") {
+            // An optional name, for the reader only
+            string name;
+            values >> name;
+
+            BodyRecord record;
+            memset(&record, 0, sizeof(record));
+            record.scale = 1;
+            bodies.push_back(record);
+        } else if (key == "lightPos") {
+            valid = readVector(values, settings.lightPos);
+        } else if (key == "cameraPosition") {
+            valid = readVector(values, settings.cameraStartPosition);
+        } else if (key == "cameraDirection") {
+            valid = readVector(values, settings.cameraStartDirection);
+        } else if (key == "cameraUp") {
+            valid = readVector(values, settings.cameraStartUp);
+        } else if (!(values >> value)) {
+            valid = false;
+        } else if (key == "radius") {
+            settings.radius = value;
+            valid = value > 0;
+        } else if (key == "moonRadius") {
+            settings.moonRadius = value;
+            valid = value > 0;
+        } else if (key == "horizontalSplitCount") {
+            // Bounded before the cast, the mesh size is checked once both are known
+            valid = value >= 3 && value <= INT_MAX;
+            if (valid)
+                settings.horizontalSplitCount = (int) value;
+        } else if (key == "verticalSplitCount") {
+            valid = value >= 2 && value <= INT_MAX;
+            if (valid)
+                settings.verticalSplitCount = (int) value;
+        } else if (key == "atmosphereHeight") {
+            settings.atmosphereHeight = value;
+            valid = value > 0;
+        } else if (key == "earthSpinRate") {
+            settings.earthSpinRate = glm::radians(value);
+        } else if (!body) {
+            printf("%s:%d: '%s' is not a scene setting\n", textPath, lineNumber, key.c_str());
+            return false;
+        } else if (key == "semiMajorAxis") {
+            body->semiMajorAxis = value;
+            valid = value > 0;
+        } else if (key == "eccentricity") {
+            body->eccentricity = value;
+            valid = value >= 0 && value < 1;
+        } else if (key == "inclination") {
+            body->inclination = glm::radians(value);
+        } else if (key == "ascendingNode") {
+            body->ascendingNode = glm::radians(value);
+        } else if (key == "argumentOfPeriapsis") {
+            body->argumentOfPeriapsis = glm::radians(value);
+        } else if (key == "meanAnomaly") {
+            body->meanAnomalyAtEpoch = glm::radians(value);
+        } else if (key == "meanMotion") {
+            body->meanMotion = glm::radians(value);
+        } else if (key == "epoch") {
+            body->epoch = value;
+        } else if (key == "spin") {
+            body->spinAtEpoch = glm::radians(value);
+        } else if (key == "spinRate") {
+            body->spinRate = glm::radians(value);
+        } else if (key == "scale") {
+            body->scale = value;
+            valid = value > 0;
+        } else {
+            printf("%s:%d: unknown key '%s'\n", textPath, lineNumber, key.c_str());
+            return false;
+        }
+
+        string extra;
+        if (!valid || values >> extra) {
+            printf("%s:%d: invalid value for '%s'\n", textPath, lineNumber, key.c_str());
+            return false;
+        }
+    }
+
+    // generateSphere numbers vertices and counts indices in int
+    long long columns = settings.horizontalSplitCount, rows = settings.verticalSplitCount;
+    if ((columns + 1)*(rows + 1) > INT_MAX || 6*columns*(rows - 1) > INT_MAX) {
+        printf("%s: a %lldx%lld split sphere has more vertices or indices than fit in an int\n", textPath, columns,
+               rows);
+        return false;
+    }
+    return true;
+}
+
+static bool writeSection(FILE *file, const void *data, size_t bytes, long long &offset)
+{
+    static const char padding[sectionAlignment] = {};
+    long long aligned = alignSection(offset);
+    if (fwrite(padding, 1, aligned - offset, file) != (size_t) (aligned - offset))
+        return false;
+    offset = aligned + bytes;
+    return bytes == 0 || fwrite(data, 1, bytes, file) == bytes;
+}
+
+bool SceneFile::compile(const char *textPath, const char *binaryPath)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Value initialised: zeroed, padding included, then the setting defaults
+    SceneHeader header = SceneHeader();
+
+    vector<BodyRecord> bodies;
+    if (!parseScene(textPath, header.settings, bodies))
+        return false;
+    const SceneSettings &settings = header.settings;
+
+    vector<float> vertices[meshCount];
+    vector<int> indices[meshCount];
+    float radii[meshCount] = {settings.radius, settings.moonRadius, settings.radius + settings.atmosphereHeight};
+    for (int mesh = 0; mesh < meshCount; mesh++)
+        generateSphere(radii[mesh], settings.horizontalSplitCount, settings.verticalSplitCount, vertices[mesh],
+                       indices[mesh]);
+
+    // Lay the sections out first, the header records where they went
+    memcpy(header.magic, sceneMagic, sizeof(sceneMagic));
+    header.version = sceneVersion;
+    header.bodyCount = (int) bodies.size();
+    sourceStamp(textPath, header.sourceSize, header.sourceTime);
+
+    long long offset = sizeof(header);
+    header.bodyOffset = alignSection(offset);
+    offset = header.bodyOffset + bodies.size()*sizeof(BodyRecord);
+    for (int mesh = 0; mesh < meshCount; mesh++) {
+        MeshSection &section = header.meshes[mesh];
+        section.vertexCount = vertices[mesh].size()/floatsPerVertex;
+        section.vertexOffset = alignSection(offset);
+        offset = section.vertexOffset + vertices[mesh].size()*sizeof(float);
+        section.indexCount = indices[mesh].size();
+        section.maxIndex = -1;
+        long long minIndex = 0;
+        for (size_t i = 0; i < indices[mesh].size(); i++) {
+            section.maxIndex = max(section.maxIndex, (long long) indices[mesh][i]);
+            minIndex = min(minIndex, (long long) indices[mesh][i]);
+        }
+        if (minIndex < 0 || section.maxIndex >= section.vertexCount) {
+            printf("Scene %s generated a mesh with indices out of range\n", textPath);
+            return false;
+        }
+        section.indexOffset = alignSection(offset);
+        offset = section.indexOffset + indices[mesh].size()*sizeof(int);
+    }
+    header.fileSize = offset;
+
+    // Written next to the target and renamed, so a failed write never leaves a half file to map
+    string temporaryPath = string(binaryPath) + ".tmp";
+    FILE *file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        printf("Cannot write compiled scene %s\n", binaryPath);
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header);
+    written = written && writeSection(file, bodies.data(), bodies.size()*sizeof(BodyRecord), offset);
+    for (int mesh = 0; mesh < meshCount; mesh++) {
+        written = written && writeSection(file, vertices[mesh].data(), vertices[mesh].size()*sizeof(float), offset);
+        written = written && writeSection(file, indices[mesh].data(), indices[mesh].size()*sizeof(int), offset);
+    }
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(temporaryPath.c_str(), binaryPath) != 0) {
+        printf("Cannot write compiled scene %s\n", binaryPath);
+        remove(temporaryPath.c_str());
+        return false;
+    }
+
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("Scene %s compiled in %.0f ms\n", textPath, elapsed);
+    return true;
+}
+
+bool SceneFile::load(const char *path)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    string binaryPath = string(path) + ".bin";
+    bool loaded = map(binaryPath.c_str(), path) ||
+                  (compile(path, binaryPath.c_str()) && map(binaryPath.c_str(), path));
+
+    loadTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return loaded;
+}
+
+bool SceneFile::map(const char *binaryPath, const char *textPath)
+{
+    close();
+
+    int fd = open(binaryPath, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SceneHeader))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    bool valid = data != MAP_FAILED;
+    const SceneHeader *header = (const SceneHeader *) data;
+    long long size = st.st_size;
+    valid = valid && memcmp(header->magic, sceneMagic, sizeof(sceneMagic)) == 0 &&
+            header->version == sceneVersion && header->fileSize == size;
+
+    // A missing text keeps the compiled scene usable on its own
+    long long sourceSize, sourceTime;
+    if (valid && sourceStamp(textPath, sourceSize, sourceTime))
+        valid = header->sourceSize == sourceSize && header->sourceTime == sourceTime;
+
+    // Every section has to lie inside the file before anything points into
+    // it. The indices were range checked when compiling; comparing their
+    // recorded maximum keeps a damaged header from sending the GPU indices
+    // past the vertices without reading the index data here.
+    valid = valid && sectionFits(header->bodyOffset, header->bodyCount, sizeof(BodyRecord), size);
+    for (int mesh = 0; valid && mesh < meshCount; mesh++) {
+        const MeshSection &section = header->meshes[mesh];
+        valid = sectionFits(section.vertexOffset, section.vertexCount, floatsPerVertex*sizeof(float), size) &&
+                sectionFits(section.indexOffset, section.indexCount, sizeof(int), size) &&
+                section.indexCount <= INT_MAX && section.indexCount%3 == 0 && section.maxIndex >= -1 &&
+                section.maxIndex < section.vertexCount && (section.indexCount == 0) == (section.maxIndex == -1);
+    }
+
+    if (!valid) {
+        if (data != MAP_FAILED)
+            munmap(data, st.st_size);
+        printf("Compiled scene %s is stale, recompiling\n", binaryPath);
+        return false;
+    }
+
+    mapping = data;
+    mappingSize = size;
+    return true;
+}
+
+void SceneFile::close()
+{
+    if (mapping)
+        munmap(mapping, mappingSize);
+    mapping = NULL;
+    mappingSize = 0;
+}
+
+const SceneSettings &SceneFile::settings() const
+{
+    return ((const SceneHeader *) mapping)->settings;
+}
+
+int SceneFile::bodyCount() const
+{
+    return ((const SceneHeader *) mapping)->bodyCount;
+}
+
+OrbitalBody SceneFile::body(int index) const
+{
+    const SceneHeader *header = (const SceneHeader *) mapping;
+    const BodyRecord &record = ((const BodyRecord *) ((const char *) mapping + header->bodyOffset))[index];
+
+    OrbitalBody body;
+    body.elements.semiMajorAxis = record.semiMajorAxis;
+    body.elements.eccentricity = record.eccentricity;
+    body.elements.inclination = record.inclination;
+    body.elements.ascendingNode = record.ascendingNode;
+    body.elements.argumentOfPeriapsis = record.argumentOfPeriapsis;
+    body.elements.meanAnomalyAtEpoch = record.meanAnomalyAtEpoch;
+    body.elements.meanMotion = record.meanMotion;
+    body.elements.epoch = record.epoch;
+    body.spinAtEpoch = record.spinAtEpoch;
+    body.spinRate = record.spinRate;
+    body.scale = record.scale;
+    return body;
+}
+
+const float *SceneFile::vertices(int mesh) const
+{
+    const SceneHeader *header = (const SceneHeader *) mapping;
+    return (const float *) ((const char *) mapping + header->meshes[mesh].vertexOffset);
+}
+
+size_t SceneFile::vertexBytes(int mesh) const
+{
+    return ((const SceneHeader *) mapping)->meshes[mesh].vertexCount*floatsPerVertex*sizeof(float);
+}
+
+const int *SceneFile::indices(int mesh) const
+{
+    const SceneHeader *header = (const SceneHeader *) mapping;
+    return (const int *) ((const char *) mapping + header->meshes[mesh].indexOffset);
+}
+
+int SceneFile::indexCount(int mesh) const
+{
+    return (int) ((const SceneHeader *) mapping)->meshes[mesh].indexCount;
+}
+
+void SceneFile::benchmark(int bodyCount, ostream &out)
+{
+    // A directory of its own, so no file of the user's is overwritten or removed
+    char directory[] = "/tmp/hw3-bench-XXXXXX";
+    if (!mkdtemp(directory)) {
+        out << "Cannot create a directory for the scene benchmark" << endl;
+        return;
+    }
+    string textFile = string(directory) + "/bench.scene";
+    string binaryPath = textFile + ".bin";
+    const char *textPath = textFile.c_str();
+
+    FILE *text = fopen(textPath, "w");
+    if (!text) {
+        out << "Cannot write " << textPath << endl;
+        rmdir(directory);
+        return;
+    }
+    srand(1);
+    fprintf(text, "# %d random bodies\n", bodyCount);
+    for (int i = 0; i < bodyCount; i++) {
+        fprintf(text, "body\n");
+        fprintf(text, "    semiMajorAxis %.3f\n", 1000 + 9000.0*rand()/RAND_MAX);
+        fprintf(text, "    eccentricity %.4f\n", 0.95*rand()/RAND_MAX);
+        fprintf(text, "    inclination %.3f\n", 180.0*rand()/RAND_MAX);
+        fprintf(text, "    ascendingNode %.3f\n", 360.0*rand()/RAND_MAX);
+        fprintf(text, "    argumentOfPeriapsis %.3f\n", 360.0*rand()/RAND_MAX);
+        fprintf(text, "    meanAnomaly %.3f\n", 360.0*rand()/RAND_MAX);
+        fprintf(text, "    meanMotion %.5f\n", 360.0/(100 + 10000.0*rand()/RAND_MAX));
+        fprintf(text, "    spinRate %.4f\n", 5.0*rand()/RAND_MAX);
+        fprintf(text, "    scale %.3f\n", 0.1 + 0.9*rand()/RAND_MAX);
+    }
+    fclose(text);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool compiled = compile(textPath, binaryPath.c_str());
+    double compileTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    // Mapping alone, then mapping and handing every body to the propagator
+    // the way the renderer starts up
+    double mapTime = 0, startupTime = 0;
+    long long loads = 0;
+    size_t fileSize = 0;
+    for (int pass = 0; compiled && pass < 2; pass++) {
+        start = chrono::steady_clock::now();
+        double elapsed = 0;
+        loads = 0;
+        while (elapsed < 0.5 || loads < 3) {
+            SceneFile scene;
+            if (!scene.load(textPath)) {
+                compiled = false;
+                break;
+            }
+            fileSize = scene.size();
+            if (pass == 1) {
+                OrbitPropagator propagator;
+                for (int i = 0; i < scene.bodyCount(); i++)
+                    propagator.addBody(scene.body(i));
+            }
+            loads++;
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        (pass == 0 ? mapTime : startupTime) = elapsed*1000/loads;
+    }
+
+    remove(textPath);
+    remove(binaryPath.c_str());
+    rmdir(directory);
+    if (!compiled) {
+        out << "Scene benchmark failed" << endl;
+        return;
+    }
+
+    out << bodyCount << " bodies, " << fileSize/1024 << " KB compiled: text compile " << compileTime
+        << " ms, mapped load " << mapTime << " ms, load with bodies " << startupTime << " ms, "
+        << (startupTime - mapTime)*1e6/max(bodyCount, 1) << " ns/body" << endl;
+}
@@ -0,0 +1,92 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <iostream>
+#include "../glm/glm/glm.hpp"
+#include "OrbitPropagator.h"
+
+using namespace std;
+
+// Everything a scene file sets besides its bodies, stored as is in the
+// compiled header
+struct SceneSettings {
+    float radius = 600;
+    float moonRadius = 162;             // radius of the shared body mesh, scaled per body
+    int horizontalSplitCount = 250;
+    int verticalSplitCount = 125;
+    float atmosphereHeight = 120;
+    double earthSpinRate = 0.12;        // radians per second
+    glm::vec3 lightPos = glm::vec3(0, 4000, 0);
+    glm::vec3 cameraStartPosition = glm::vec3(0, 4000, 4000);
+    glm::vec3 cameraStartDirection = glm::vec3(0, -1, -1);
+    glm::vec3 cameraStartUp = glm::vec3(0, 0, 1);
+};
+
+// A scene described in a text file, one "key values" line each, '#' starts
+// a comment. Scene keys (angles in degrees, rates in degrees per second):
+//   radius, moonRadius, horizontalSplitCount, verticalSplitCount,
+//   atmosphereHeight, earthSpinRate, lightPos x y z, cameraPosition x y z,
+//   cameraDirection x y z, cameraUp x y z
+// "body [name]" starts an orbiting body, the keys after it set its orbit:
+//   semiMajorAxis, eccentricity, inclination, ascendingNode,
+//   argumentOfPeriapsis, meanAnomaly, meanMotion, epoch, spin, spinRate, scale
+// The text is compiled once into <path>.bin, which holds the settings, the
+// body records and the generated world, moon and sky meshes in the layout
+// the renderer uploads. Loading maps that file and checks its header, so it
+// costs the same for any number of bodies; it is recompiled whenever the
+// text changes.
+class SceneFile {
+public:
+    enum meshes {
+        worldMesh, moonMesh, skyMesh,
+        meshCount
+    };
+
+    SceneFile() : mapping(NULL), mappingSize(0), loadTime(0) {}
+
+    SceneFile(const SceneFile &) = delete;
+
+    SceneFile &operator=(const SceneFile &) = delete;
+
+    ~SceneFile() { close(); }
+
+    bool load(const char *path);
+
+    // Unmaps the file, everything below is invalid afterwards
+    void close();
+
+    bool loaded() const { return mapping != NULL; }
+
+    const SceneSettings &settings() const;
+
+    int bodyCount() const;
+
+    OrbitalBody body(int index) const;
+
+    // Interleaved position, normal and texture coordinates, 8 floats per vertex
+    const float *vertices(int mesh) const;
+
+    size_t vertexBytes(int mesh) const;
+
+    const int *indices(int mesh) const;
+
+    int indexCount(int mesh) const;
+
+    size_t size() const { return mappingSize; }
+
+    // ms spent in the last load(), compiling included
+    double lastLoadTime() const { return loadTime; }
+
+    static bool compile(const char *textPath, const char *binaryPath);
+
+    static void benchmark(int bodyCount, ostream &out);
+
+private:
+    void *mapping;
+    size_t mappingSize;
+    double loadTime;
+
+    bool map(const char *binaryPath, const char *textPath);
+};
+
+#endif
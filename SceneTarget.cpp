@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include "SceneTarget.h"
+
+using namespace std;
+
+// Texture unit the scene colour is sampled from during present(); the scene
+// textures keep units 0-2 bound for the whole run.
+static const int presentTextureUnit = 7;
+
+void SceneTarget::init(GLState *state, ResourceManager *resources)
+{
+    this->state = state;
+    this->resources = resources;
+    program = resources->adoptProgram("upscale shader", initShaders("upscaleShader.vert", "upscaleShader.frag"));
+
+    // Core profile needs a bound VAO even though the fullscreen triangle
+    // is generated from gl_VertexID
+    emptyVAO = resources->createVertexArray("fullscreen triangle");
+
+    GLuint programID = program.name();
+    state->useProgram(programID);
+    sceneColor_id = glGetUniformLocation(programID, "SceneColor");
+    state->uniform1i(sceneColor_id, presentTextureUnit);
+    uvScale_id = glGetUniformLocation(programID, "uvScale");
+    uvClamp_id = glGetUniformLocation(programID, "uvClamp");
+    texelSize_id = glGetUniformLocation(programID, "texelSize");
+    filter_id = glGetUniformLocation(programID, "upscaleFilter");
+    fxaa_id = glGetUniformLocation(programID, "fxaaEnabled");
+    sharpness_id = glGetUniformLocation(programID, "sharpness");
+}
+
+void SceneTarget::resize(int width, int height, int antiAliasing)
+{
+    if (width == this->width && height == this->height && antiAliasing == this->antiAliasing)
+        return;
+
+    deleteAttachments();
+
+    this->width = width;
+    this->height = height;
+    this->antiAliasing = antiAliasing;
+
+    switch (antiAliasing) {
+        case msaa2: samples = 2; break;
+        case msaa4: samples = 4; break;
+        case msaa8: samples = 8; break;
+        default: samples = 0; break;
+    }
+
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    if (samples > maxSamples)
+        samples = maxSamples;
+
+    // Single sampled target, this is what present() samples from
+    colorTexture = resources->createTexture("scene color", false);
+    resources->bindTextureForEdit(presentTextureUnit, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    resources->textureStorage(colorTexture, GL_TEXTURE_2D, GL_RGBA8, width, height, 1, false);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    depthBuffer = resources->createRenderbuffer("scene depth");
+    resources->renderbufferStorage(depthBuffer, GL_DEPTH24_STENCIL8, 0, width, height);
+
+    FBO = resources->createFramebuffer("scene framebuffer");
+    state->bindFramebuffer(GL_FRAMEBUFFER, FBO.name());
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture.name(), 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer.name());
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("Scene framebuffer is incomplete (%dx%d)\n", width, height);
+
+    // Multisampled target, resolved into the single sampled one in end()
+    if (samples > 0) {
+        msaaColorBuffer = resources->createRenderbuffer("multisampled scene color");
+        resources->renderbufferStorage(msaaColorBuffer, GL_RGBA8, samples, width, height);
+
+        msaaDepthBuffer = resources->createRenderbuffer("multisampled scene depth");
+        resources->renderbufferStorage(msaaDepthBuffer, GL_DEPTH24_STENCIL8, samples, width, height);
+
+        msaaFBO = resources->createFramebuffer("multisampled scene framebuffer");
+        state->bindFramebuffer(GL_FRAMEBUFFER, msaaFBO.name());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msaaColorBuffer.name());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                  msaaDepthBuffer.name());
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            printf("Multisampled scene framebuffer is incomplete (%dx%d, %d samples)\n", width, height, samples);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    state->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneTarget::begin(int renderWidth, int renderHeight)
+{
+    this->renderWidth = renderWidth < width ? renderWidth : width;
+    this->renderHeight = renderHeight < height ? renderHeight : height;
+
+    state->bindFramebuffer(GL_FRAMEBUFFER, samples > 0 ? msaaFBO.name() : FBO.name());
+    state->viewport(0, 0, this->renderWidth, this->renderHeight);
+    state->enable(GL_DEPTH_TEST);
+}
+
+void SceneTarget::end()
+{
+    if (samples > 0) {
+        state->bindFramebuffer(GL_READ_FRAMEBUFFER, msaaFBO.name());
+        state->bindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO.name());
+        glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+    state->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneTarget::present(int screenWidth, int screenHeight, int upscaleFilter)
+{
+    state->viewport(0, 0, screenWidth, screenHeight);
+    state->disable(GL_DEPTH_TEST);
+
+    state->useProgram(program.name());
+    resources->bindTexture(presentTextureUnit, colorTexture);
+
+    // Only the rendered sub-rectangle is valid; keep bilinear taps half a
+    // texel inside it so nothing bleeds in from the unused area
+    state->uniform2f(uvScale_id, (GLfloat) renderWidth/width, (GLfloat) renderHeight/height);
+    state->uniform2f(uvClamp_id, (renderWidth - 0.5f)/width, (renderHeight - 0.5f)/height);
+    state->uniform2f(texelSize_id, 1.0f/width, 1.0f/height);
+    state->uniform1i(filter_id, upscaleFilter);
+    state->uniform1i(fxaa_id, antiAliasing == fxaa);
+    state->uniform1f(sharpness_id, sharpness);
+
+    state->bindVertexArray(emptyVAO.name());
+    state->drawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void SceneTarget::destroy()
+{
+    deleteAttachments();
+
+    emptyVAO.reset();
+    program.reset();
+}
+
+const char *SceneTarget::antiAliasingName(int antiAliasing)
+{
+    switch (antiAliasing) {
+        case noAA: return "off";
+        case msaa2: return "MSAA 2x";
+        case msaa4: return "MSAA 4x";
+        case msaa8: return "MSAA 8x";
+        case fxaa: return "FXAA";
+    }
+    return "unknown";
+}
+
+void SceneTarget::deleteAttachments()
+{
+    FBO.reset();
+    colorTexture.reset();
+    depthBuffer.reset();
+    msaaFBO.reset();
+    msaaColorBuffer.reset();
+    msaaDepthBuffer.reset();
+}
@@ -0,0 +1,66 @@
+#ifndef SCENETARGET_H
+#define SCENETARGET_H
+
+#include <GL/glew.h>
+#include "Shader.h"
+#include "GLState.h"
+#include "ResourceManager.h"
+
+using namespace std;
+
+// Offscreen framebuffer the scene is drawn into. It is allocated at the full
+// window size and the scene is rendered into its lower-left sub-rectangle, so
+// changing the render scale never reallocates anything. present() upscales
+// that sub-rectangle to the default framebuffer.
+class SceneTarget {
+public:
+    enum antiAliasingOptions {
+        noAA = 0, msaa2 = 1, msaa4 = 2, msaa8 = 3, fxaa = 4
+    };
+    enum upscaleFilterOptions {
+        bilinear = 0, sharpen = 1
+    };
+
+    float sharpness = 0.5;
+
+    void init(GLState *state, ResourceManager *resources);
+
+    // Reallocates the attachments only when the size or AA mode changed.
+    void resize(int width, int height, int antiAliasing);
+
+    void begin(int renderWidth, int renderHeight);
+
+    void end();
+
+    void present(int screenWidth, int screenHeight, int upscaleFilter);
+
+    void destroy();
+
+    static const char *antiAliasingName(int antiAliasing);
+
+private:
+    GLState *state = NULL;
+    ResourceManager *resources = NULL;
+    ResourceHandle program;
+    ResourceHandle emptyVAO;
+    ResourceHandle FBO, colorTexture, depthBuffer;
+    ResourceHandle msaaFBO, msaaColorBuffer, msaaDepthBuffer;
+    int width = 0;
+    int height = 0;
+    int samples = 0;
+    int antiAliasing = -1;
+    int renderWidth = 0;
+    int renderHeight = 0;
+
+    GLint sceneColor_id;
+    GLint uvScale_id;
+    GLint uvClamp_id;
+    GLint texelSize_id;
+    GLint filter_id;
+    GLint fxaa_id;
+    GLint sharpness_id;
+
+    void deleteAttachments();
+};
+
+#endif
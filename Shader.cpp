@@ -85,6 +85,17 @@ bool readDataFromFile(const string& fileName, string &data)
         string curLine;
 
         while (getline(myfile, curLine)){
+            // #include "file" pastes shared GLSL in place
+            if (curLine.compare(0, 10, "#include \"") == 0) {
+                string includeName = curLine.substr(10, curLine.find('"', 10) - 10);
+                if (!readDataFromFile(includeName, data)) {
+                    cout << "Cannot find included file name: " + includeName << endl;
+                    return false;
+                }
+                data += "\n";
+                continue;
+            }
+
             data += curLine;
             if (!myfile.eof())
                 data += "\n";
@@ -0,0 +1,189 @@
+// Atmospheric scattering lookups shared by worldShader.frag and skyShader.frag.
+// The tables and their parametrisation come from Atmosphere.cpp; r is the
+// distance from the planet centre, mu the view zenith cosine and muS the sun
+// zenith cosine.
+
+uniform sampler2D TransmittanceLUT;
+uniform sampler3D ScatteringLUT;
+uniform float planetRadius;
+uniform float atmosphereRadius;
+uniform vec3 rayleighScattering;
+uniform vec3 mieScattering;
+uniform float mieG;
+uniform float muSMin;
+uniform float sunIntensity;
+
+const float atmospherePI = 3.14159265359;
+// Softens the planet's shadow edge, roughly the sun's angular radius
+const float sunAngularRadius = 0.01;
+const float exposure = 1.0;
+
+// Maps [0, 1] onto texel centres so the ends are not blended with the border
+float coordFromUnit(float x, float size)
+{
+    return 0.5/size + x*(1.0 - 1.0/size);
+}
+
+// The one exposure and tonemap for everything lit in linear space, so the
+// planet and the sky end up on the same scale
+vec3 toneMap(vec3 radiance)
+{
+    return 1.0 - exp(-exposure*radiance);
+}
+
+float distanceToTop(float r, float mu)
+{
+    float discriminant = r*r*(mu*mu - 1.0) + atmosphereRadius*atmosphereRadius;
+    return max(-r*mu + sqrt(max(discriminant, 0.0)), 0.0);
+}
+
+bool intersectsGround(float r, float mu)
+{
+    return mu < 0.0 && r*r*(mu*mu - 1.0) + planetRadius*planetRadius >= 0.0;
+}
+
+vec3 transmittanceToTop(float r, float mu)
+{
+    float H = sqrt(atmosphereRadius*atmosphereRadius - planetRadius*planetRadius);
+    float rho = sqrt(max(r*r - planetRadius*planetRadius, 0.0));
+    float d = distanceToTop(r, mu);
+    float dMin = atmosphereRadius - r;
+    float dMax = rho + H;
+    float xMu = dMax > dMin ? (d - dMin)/(dMax - dMin) : 0.0;
+
+    vec2 size = vec2(textureSize(TransmittanceLUT, 0));
+    vec2 uv = vec2(coordFromUnit(clamp(xMu, 0.0, 1.0), size.x), coordFromUnit(rho/H, size.y));
+    return texture(TransmittanceLUT, uv).rgb;
+}
+
+// Transmittance over a segment of length d, which must stay in the atmosphere
+vec3 transmittanceAlong(float r, float mu, float d, bool rayHitsGround)
+{
+    float rd = clamp(sqrt(d*d + 2.0*r*mu*d + r*r), planetRadius, atmosphereRadius);
+    float mud = clamp((r*mu + d)/rd, -1.0, 1.0);
+
+    if (rayHitsGround)
+        return min(transmittanceToTop(rd, -mud)/transmittanceToTop(r, -mu), vec3(1.0));
+    return min(transmittanceToTop(r, mu)/transmittanceToTop(rd, mud), vec3(1.0));
+}
+
+vec3 transmittanceToSun(float r, float muS)
+{
+    float sinHorizon = planetRadius/r;
+    float cosHorizon = -sqrt(max(1.0 - sinHorizon*sinHorizon, 0.0));
+    float visible = smoothstep(-sinHorizon*sunAngularRadius, sinHorizon*sunAngularRadius, muS - cosHorizon);
+    return transmittanceToTop(r, muS)*visible;
+}
+
+vec4 scatteringTexel(float r, float mu, float muS, bool rayHitsGround)
+{
+    vec3 size = vec3(textureSize(ScatteringLUT, 0));
+    float H = sqrt(atmosphereRadius*atmosphereRadius - planetRadius*planetRadius);
+    float rho = sqrt(max(r*r - planetRadius*planetRadius, 0.0));
+    float discriminant = r*r*(mu*mu - 1.0) + planetRadius*planetRadius;
+
+    float uMu;
+    if (rayHitsGround) {
+        float d = -r*mu - sqrt(max(discriminant, 0.0));
+        float dMin = r - planetRadius;
+        float dMax = rho;
+        float x = dMax == dMin ? 0.0 : (d - dMin)/(dMax - dMin);
+        uMu = 0.5 - 0.5*coordFromUnit(clamp(x, 0.0, 1.0), size.y*0.5);
+    } else {
+        float d = -r*mu + sqrt(max(discriminant + H*H, 0.0));
+        float dMin = atmosphereRadius - r;
+        float dMax = rho + H;
+        float x = (d - dMin)/(dMax - dMin);
+        uMu = 0.5 + 0.5*coordFromUnit(clamp(x, 0.0, 1.0), size.y*0.5);
+    }
+
+    float uMuS = coordFromUnit(clamp((muS - muSMin)/(1.0 - muSMin), 0.0, 1.0), size.x);
+    float uR = coordFromUnit(rho/H, size.z);
+    return texture(ScatteringLUT, vec3(uMuS, uMu, uR));
+}
+
+float rayleighPhase(float nu)
+{
+    return 3.0/(16.0*atmospherePI)*(1.0 + nu*nu);
+}
+
+float miePhase(float nu)
+{
+    float g2 = mieG*mieG;
+    float k = 3.0/(8.0*atmospherePI)*(1.0 - g2)/(2.0 + g2);
+    return k*(1.0 + nu*nu)/pow(1.0 + g2 - 2.0*mieG*nu, 1.5);
+}
+
+// The table keeps only the red Mie channel; the others follow from the
+// ratio of the Rayleigh channels
+vec3 applyPhase(vec4 scattering, float nu)
+{
+    vec3 mie = scattering.r > 0.0 ?
+               scattering.rgb*scattering.a/scattering.r*(rayleighScattering.r/mieScattering.r)*
+               (mieScattering/rayleighScattering) : vec3(0.0);
+    return scattering.rgb*rayleighPhase(nu) + mie*miePhase(nu);
+}
+
+// Moves a camera outside the atmosphere to where the ray enters it. Returns
+// false when the ray misses the atmosphere.
+bool enterAtmosphere(inout vec3 origin, vec3 direction)
+{
+    float r = length(origin);
+    if (r <= atmosphereRadius)
+        return true;
+
+    float rmu = dot(origin, direction);
+    float discriminant = rmu*rmu - r*r + atmosphereRadius*atmosphereRadius;
+    float t = -rmu - sqrt(max(discriminant, 0.0));
+    if (discriminant < 0.0 || t < 0.0)
+        return false;
+
+    origin += t*direction;
+    return true;
+}
+
+// Radiance scattered towards the camera along a ray leaving the atmosphere
+vec3 skyRadiance(vec3 camera, vec3 direction, vec3 sunPosition)
+{
+    vec3 origin = camera;
+    if (!enterAtmosphere(origin, direction))
+        return vec3(0.0);
+
+    float r = length(origin);
+    float mu = dot(origin, direction)/r;
+    vec3 sunDirection = normalize(sunPosition - origin);
+    float muS = dot(origin, sunDirection)/r;
+    float nu = dot(direction, sunDirection);
+
+    return applyPhase(scatteringTexel(r, mu, muS, intersectsGround(r, mu)), nu)*sunIntensity;
+}
+
+// Radiance scattered towards the camera in front of a surface point, and the
+// transmittance from the point to the camera
+vec3 radianceToPoint(vec3 camera, vec3 point, vec3 sunPosition, out vec3 transmittance)
+{
+    transmittance = vec3(1.0);
+    vec3 direction = normalize(point - camera);
+    vec3 origin = camera;
+    if (!enterAtmosphere(origin, direction))
+        return vec3(0.0);
+
+    float r = length(origin);
+    float mu = dot(origin, direction)/r;
+    vec3 sunDirection = normalize(sunPosition - origin);
+    float muS = dot(origin, sunDirection)/r;
+    float nu = dot(direction, sunDirection);
+    bool rayHitsGround = intersectsGround(r, mu);
+
+    float d = max(dot(point - origin, direction), 0.0);
+    transmittance = transmittanceAlong(r, mu, d, rayHitsGround);
+
+    // In-scattering from the camera to infinity minus the part beyond the point
+    float rp = clamp(length(point), planetRadius, atmosphereRadius);
+    float mup = clamp((r*mu + d)/rp, -1.0, 1.0);
+    float muSp = clamp((r*muS + d*nu)/rp, -1.0, 1.0);
+    vec4 scattering = scatteringTexel(r, mu, muS, rayHitsGround) -
+                      vec4(transmittance, transmittance.r)*scatteringTexel(rp, mup, muSp, rayHitsGround);
+
+    return applyPhase(max(scattering, vec4(0.0)), nu)*sunIntensity;
+}
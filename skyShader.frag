@@ -0,0 +1,23 @@
+#version 430
+
+in vec3 Position;
+
+uniform vec3 lightPosition;
+uniform vec3 cameraPosition;
+
+out vec4 FragColor;
+
+#include "atmosphere.glsl"
+
+void main()
+{
+    // Only the far side of the shell is shaded: it is unique for every view
+    // ray, and the depth test drops it wherever the planet or a mountain is
+    // in front, where worldShader.frag adds the haze instead
+    vec3 direction = normalize(Position - cameraPosition);
+    if (dot(Position, direction) <= 0.0)
+        discard;
+
+    vec3 radiance = skyRadiance(cameraPosition, direction, lightPosition);
+    FragColor = vec4(toneMap(radiance), 1.0);
+}
@@ -0,0 +1,15 @@
+#version 430
+
+layout (location = 0) in vec3 VertexPosition;
+
+uniform mat4 ProjectionMatrix;
+uniform mat4 ViewMatrix;
+
+out vec3 Position;
+
+void main()
+{
+    // The shell is a sphere around the origin, spinning it changes nothing
+    Position = VertexPosition;
+    gl_Position = ProjectionMatrix * ViewMatrix * vec4(VertexPosition, 1);
+}
@@ -0,0 +1,85 @@
+#version 430
+
+in vec2 TexCoord;
+
+uniform sampler2D SceneColor;
+uniform vec2 uvScale;     // rendered size / target size
+uniform vec2 uvClamp;     // last valid texel centre of the rendered area
+uniform vec2 texelSize;   // 1 / target size
+uniform int upscaleFilter;
+uniform int fxaaEnabled;
+uniform float sharpness;
+
+out vec4 FragColor;
+
+const float FXAA_SPAN_MAX = 8.0;
+const float FXAA_REDUCE_MUL = 1.0/8.0;
+const float FXAA_REDUCE_MIN = 1.0/128.0;
+const vec3 lumaWeights = vec3(0.299, 0.587, 0.114);
+
+
+vec3 sampleScene(vec2 uv)
+{
+    return texture(SceneColor, clamp(uv, 0.5*texelSize, uvClamp)).rgb;
+}
+
+vec3 fxaa(vec2 uv)
+{
+    vec3 rgbNW = sampleScene(uv + vec2(-1.0, -1.0)*texelSize);
+    vec3 rgbNE = sampleScene(uv + vec2(1.0, -1.0)*texelSize);
+    vec3 rgbSW = sampleScene(uv + vec2(-1.0, 1.0)*texelSize);
+    vec3 rgbSE = sampleScene(uv + vec2(1.0, 1.0)*texelSize);
+    vec3 rgbM = sampleScene(uv);
+
+    float lumaNW = dot(rgbNW, lumaWeights);
+    float lumaNE = dot(rgbNE, lumaWeights);
+    float lumaSW = dot(rgbSW, lumaWeights);
+    float lumaSE = dot(rgbSE, lumaWeights);
+    float lumaM = dot(rgbM, lumaWeights);
+
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // Blur along the local edge direction
+    vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE)*0.25*FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+    float rcpDirMin = 1.0/(min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = clamp(dir*rcpDirMin, vec2(-FXAA_SPAN_MAX), vec2(FXAA_SPAN_MAX))*texelSize;
+
+    vec3 rgbA = 0.5*(sampleScene(uv + dir*(1.0/3.0 - 0.5)) + sampleScene(uv + dir*(2.0/3.0 - 0.5)));
+    vec3 rgbB = rgbA*0.5 + 0.25*(sampleScene(uv - dir*0.5) + sampleScene(uv + dir*0.5));
+
+    float lumaB = dot(rgbB, lumaWeights);
+    if (lumaB < lumaMin || lumaB > lumaMax)
+        return rgbA;
+    return rgbB;
+}
+
+vec3 resolve(vec2 uv)
+{
+    if (fxaaEnabled != 0)
+        return fxaa(uv);
+    return sampleScene(uv);
+}
+
+void main()
+{
+    vec2 uv = TexCoord*uvScale;
+    vec3 color = resolve(uv);
+
+    if (upscaleFilter == 1) {
+        // Unsharp mask on the source texel grid, clamped to the neighbourhood
+        // so it does not ring around the bright limb of the planets
+        vec3 n = sampleScene(uv + vec2(0.0, -1.0)*texelSize);
+        vec3 s = sampleScene(uv + vec2(0.0, 1.0)*texelSize);
+        vec3 e = sampleScene(uv + vec2(1.0, 0.0)*texelSize);
+        vec3 w = sampleScene(uv + vec2(-1.0, 0.0)*texelSize);
+
+        vec3 minColor = min(color, min(min(n, s), min(e, w)));
+        vec3 maxColor = max(color, max(max(n, s), max(e, w)));
+
+        color = clamp(color + sharpness*(4.0*color - (n + s + e + w))*0.25, minColor, maxColor);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 430
+
+out vec2 TexCoord;
+
+void main()
+{
+    // Fullscreen triangle generated from the vertex index, no buffers needed
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+
+    TexCoord = pos;
+    gl_Position = vec4(pos*2.0 - 1.0, 0, 1);
+}
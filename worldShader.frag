@@ -10,6 +10,8 @@ in vec3 LightVector;
 in vec3 CameraVector;
 
 uniform vec3 lightPosition;
+uniform vec3 cameraPosition;
+uniform int atmosphereEnabled;
 uniform sampler2D TexColor;
 uniform sampler2D MoonTexColor;
 uniform sampler2D TexGrey;
@@ -17,6 +19,8 @@ uniform float textureOffset;
 
 out vec4 FragColor;
 
+#include "atmosphere.glsl"
+
 vec3 ambientReflectenceCoefficient = vec3(0.5f);
 vec3 ambientLightColor = vec3(0.6f);
 vec3 specularReflectenceCoefficient = vec3(1.0f);
@@ -40,5 +44,21 @@ void main()
     float spec = pow(max(dot(H, data.Normal), 0.0), SpecularExponent);
     vec3 specular = spec*specularReflectenceCoefficient*specularLightColor;
 
-    FragColor = vec4((diffuse+ambient+specular)*texColor.xyz, 1.0);
+    // Tonemapped either way, so toggling the atmosphere keeps the brightness
+    if (atmosphereEnabled == 0) {
+        FragColor = vec4(toneMap((diffuse+ambient+specular)*texColor.xyz), 1.0);
+        return;
+    }
+
+    // Sunlight reddens through the air above the point, and the air between
+    // the point and the camera adds haze
+    float r = length(data.Position);
+    float muS = dot(data.Position, normalize(lightPosition - data.Position))/r;
+    vec3 sunTransmittance = transmittanceToSun(clamp(r, planetRadius, atmosphereRadius), muS);
+
+    vec3 viewTransmittance;
+    vec3 inScatter = radianceToPoint(cameraPosition, data.Position, lightPosition, viewTransmittance);
+
+    vec3 surface = ((diffuse+specular)*sunTransmittance + ambient)*texColor.xyz;
+    FragColor = vec4(toneMap(surface*viewTransmittance + inScatter), 1.0);
 }